@@ -1,650 +1,7870 @@
-#include <iostream>
-#include <vector>
-#include <string>
-#include <fstream>
-#include <sstream>
-#include <algorithm>
-#include <ctime>
-#include <iomanip>
-#include <limits>
-
-using namespace std;
-
-// Function to clear the console screen
-void clearScreen() {
-    #ifdef _WIN32
-        system("cls");
-    #else
-        system("clear");
-    #endif
-}
-
-
-// Book class to represent a book in the library
-class Book {
-private:
-    string bookID;
-    string title;
-    string author;
-    string genre;
-    bool isAvailable;
-
-public:
-    Book(string id, string t, string a, string g)
-        : bookID(id), title(t), author(a), genre(g), isAvailable(true) {}
-
-    string getBookID() const { return bookID; }
-    string getTitle() const { return title; }
-    string getAuthor() const { return author; }
-    string getGenre() const { return genre; }
-    bool getAvailability() const { return isAvailable; }
-    void setAvailability(bool status) { isAvailable = status; }
-
-    string toString() const {
-        return bookID + "," + title + "," + author + "," + genre + "," + (isAvailable ? "Available" : "Borrowed");
-    }
-};
-
-// Member class to represent a library member
-class Member {
-private:
-    string memberID;
-    string name;
-    string address;
-    string phoneNumber;
-
-public:
-    Member(string id, string n, string addr, string phone)
-        : memberID(id), name(n), address(addr), phoneNumber(phone) {}
-
-    string getMemberID() const { return memberID; }
-    string getName() const { return name; }
-    string getAddress() const { return address; }
-    string getPhoneNumber() const { return phoneNumber; }
-
-    string toString() const {
-        return memberID + "," + name + "," + address + "," + phoneNumber;
-    }
-};
-
-// Transaction class to represent a book borrowing transaction
-class Transaction {
-private:
-    string transactionID;
-    string memberID;
-    string bookID;
-    time_t borrowDate;
-    time_t returnDate;
-    time_t expectedReturnDate;
-
-public:
-    Transaction(string tID, string mID, string bID)
-        : transactionID(tID), memberID(mID), bookID(bID) {
-        borrowDate = time(nullptr);
-        returnDate = 0; // 0 indicates the book hasn't been returned yet
-        expectedReturnDate = borrowDate + (14 * 24 * 60 * 60); // 14 days from borrow date
-    }
-
-    string getTransactionID() const { return transactionID; }
-    string getMemberID() const { return memberID; }
-    string getBookID() const { return bookID; }
-    time_t getBorrowDate() const { return borrowDate; }
-    time_t getReturnDate() const { return returnDate; }
-    time_t getExpectedReturnDate() const { return expectedReturnDate; }
-    void setReturnDate(time_t date) { returnDate = date; }
-
-    int calculateOverdueDays() const {
-        time_t now = time(nullptr);
-        if (returnDate == 0) {
-            return max(0, static_cast<int>((now - expectedReturnDate) / (24 * 60 * 60)));
-        }
-        return max(0, static_cast<int>((returnDate - expectedReturnDate) / (24 * 60 * 60)));
-    }
-
-    double calculateOverdueFees() const {
-        return calculateOverdueDays() * 100.0; // 100 KSH per day
-    }
-
-    string toString() const {
-        stringstream ss;
-        ss << transactionID << "," << memberID << "," << bookID << "," << borrowDate << "," << returnDate << "," << expectedReturnDate;
-        return ss.str();
-    }
-
-    string getFormattedDate(time_t date) const {
-        char buffer[26];
-        struct tm* timeinfo;
-        timeinfo = localtime(&date);
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d", timeinfo);
-        return string(buffer);
-    }
-
-    string getFormattedBorrowDate() const {
-        return getFormattedDate(borrowDate);
-    }
-
-    string getFormattedExpectedReturnDate() const {
-        return getFormattedDate(expectedReturnDate);
-    }
-};
-
-// Library class to manage books, members, and transactions
-class Library {
-private:
-    vector<Book> books;
-    vector<Member> members;
-    vector<Transaction> transactions;
-
-    // Load books from file
-    void loadBooks() {
-        ifstream file("books.txt");
-        string line;
-        while (getline(file, line)) {
-            stringstream ss(line);
-            string id, title, author, genre, status;
-            getline(ss, id, ',');
-            getline(ss, title, ',');
-            getline(ss, author, ',');
-            getline(ss, genre, ',');
-            getline(ss, status, ',');
-            Book book(id, title, author, genre);
-            book.setAvailability(status == "Available");
-            books.push_back(book);
-        }
-    }
-
-    // Load members from file
-    void loadMembers() {
-        ifstream file("members.txt");
-        string line;
-        while (getline(file, line)) {
-            stringstream ss(line);
-            string id, name, address, phone;
-            getline(ss, id, ',');
-            getline(ss, name, ',');
-            getline(ss, address, ',');
-            getline(ss, phone, ',');
-            members.push_back(Member(id, name, address, phone));
-        }
-    }
-
-    // Load transactions from file
-    void loadTransactions() {
-        ifstream file("transactions.txt");
-        string line;
-        while (getline(file, line)) {
-            stringstream ss(line);
-            string tID, mID, bID, borrowDate, returnDate;
-            getline(ss, tID, ',');
-            getline(ss, mID, ',');
-            getline(ss, bID, ',');
-            getline(ss, borrowDate, ',');
-            getline(ss, returnDate, ',');
-            Transaction t(tID, mID, bID);
-            t.setReturnDate(stoi(returnDate));
-            transactions.push_back(t);
-        }
-    }
-
-    // Save books to file
-    void saveBooks() {
-        ofstream file("books.txt");
-        for (const auto& book : books) {
-            file << book.toString() << endl;
-        }
-    }
-
-    // Save members to file
-    void saveMembers() {
-        ofstream file("members.txt");
-        for (const auto& member : members) {
-            file << member.toString() << endl;
-        }
-    }
-
-    // Save transactions to file
-    void saveTransactions() {
-        ofstream file("transactions.txt");
-        for (const auto& transaction : transactions) {
-            file << transaction.toString() << endl;
-        }
-    }
-
-public:
-    Library() {
-        loadBooks();
-        loadMembers();
-        loadTransactions();
-    }
-
-    ~Library() {
-        saveBooks();
-        saveMembers();
-        saveTransactions();
-    }
-
-    // Add a new book to the library
-    void addBook(const Book& book) {
-        if (findBook(book.getBookID()) != nullptr) {
-            throw runtime_error("Book with this ID already exists.");
-        }
-        books.push_back(book);
-        saveBooks();
-    }
-
-    // Edit an existing book's details
-    void editBook(const string& bookID, const Book& updatedBook) {
-        auto it = find_if(books.begin(), books.end(),
-                          [&bookID](const Book& b) { return b.getBookID() == bookID; });
-        if (it != books.end()) {
-            *it = updatedBook;
-            saveBooks();
-        } else {
-            throw runtime_error("Book not found.");
-        }
-    }
-
-    // Delete a book from the library
-    void deleteBook(const string& bookID) {
-        size_t initialSize = books.size();
-        books.erase(remove_if(books.begin(), books.end(),
-                              [&bookID](const Book& b) { return b.getBookID() == bookID; }),
-                    books.end());
-        if (books.size() == initialSize) {
-            throw runtime_error("Book not found.");
-        }
-        saveBooks();
-    }
-
-    // Get all books in the library
-    vector<Book> getAllBooks() const {
-        return books;
-    }
-
-    // Find a book by its ID
-    Book* findBook(const string& bookID) {
-        auto it = find_if(books.begin(), books.end(),
-                          [&bookID](const Book& b) { return b.getBookID() == bookID; });
-        return it != books.end() ? &(*it) : nullptr;
-    }
-
-    // Add a new member to the library
-    void addMember(const Member& member) {
-        if (findMember(member.getMemberID()) != nullptr) {
-            throw runtime_error("Member with this ID already exists.");
-        }
-        members.push_back(member);
-        saveMembers();
-    }
-
-    // Edit an existing member's details
-    void editMember(const string& memberID, const Member& updatedMember) {
-        auto it = find_if(members.begin(), members.end(),
-                          [&memberID](const Member& m) { return m.getMemberID() == memberID; });
-        if (it != members.end()) {
-            *it = updatedMember;
-            saveMembers();
-        } else {
-            throw runtime_error("Member not found.");
-        }
-    }
-
-    // Delete a member from the library
-    void deleteMember(const string& memberID) {
-        size_t initialSize = members.size();
-        members.erase(remove_if(members.begin(), members.end(),
-                                [&memberID](const Member& m) { return m.getMemberID() == memberID; }),
-                      members.end());
-        if (members.size() == initialSize) {
-            throw runtime_error("Member not found.");
-        }
-        saveMembers();
-    }
-
-    // Get all members of the library
-    vector<Member> getAllMembers() const {
-        return members;
-    }
-
-    // Find a member by their ID
-    Member* findMember(const string& memberID) {
-        auto it = find_if(members.begin(), members.end(),
-                          [&memberID](const Member& m) { return m.getMemberID() == memberID; });
-        return it != members.end() ? &(*it) : nullptr;
-    }
-
-    // Borrow a book
-    string borrowBook(const string& memberID, const string& bookID) {
-        Book* book = findBook(bookID);
-        Member* member = findMember(memberID);
-        if (!book) {
-            throw runtime_error("Book not found.");
-        }
-        if (!member) {
-            throw runtime_error("Member not found.");
-        }
-        if (!book->getAvailability()) {
-            throw runtime_error("Book is not available for borrowing.");
-        }
-        book->setAvailability(false);
-        string tID = to_string(transactions.size() + 1);
-        transactions.push_back(Transaction(tID, memberID, bookID));
-        saveBooks();
-        saveTransactions();
-        return tID;  // Return the transaction ID
-    }
-
-    // Return a borrowed book
-    void returnBook(const string& bookIdentifier) {
-        Book* book = nullptr;
-        // Try to find the book by ID first, then by title
-        book = findBook(bookIdentifier);
-        if (!book) {
-            auto books = searchBooks(bookIdentifier);
-            if (!books.empty()) {
-                book = &books[0];
-            }
-        }
-        if (!book) {
-            throw runtime_error("Book not found.");
-        }
-
-        auto it = find_if(transactions.rbegin(), transactions.rend(),
-                          [&](const Transaction& t) { return t.getBookID() == book->getBookID() && t.getReturnDate() == 0; });
-        if (it == transactions.rend()) {
-            throw runtime_error("No active borrowing found for this book.");
-        }
-
-        book->setAvailability(true);
-        it->setReturnDate(time(nullptr));
-        saveBooks();
-        saveTransactions();
-    }
-
-    // Get all transactions
-    vector<Transaction> getAllTransactions() const {
-        return transactions;
-    }
-
-    // Search for books by ID or title
-    vector<Book> searchBooks(const string& query) const {
-        vector<Book> results;
-        for (const auto& book : books) {
-            if (book.getBookID() == query || book.getTitle().find(query) != string::npos) {
-                results.push_back(book);
-            }
-        }
-        return results;
-    }
-
-    // Search for members by ID or name
-    vector<Member> searchMembers(const string& query) const {
-        vector<Member> results;
-        for (const auto& member : members) {
-            if (member.getMemberID() == query || member.getName().find(query) != string::npos) {
-                results.push_back(member);
-            }
-        }
-        return results;
-    }
-
-    // Get all available books
-    vector<Book> getAvailableBooks() const {
-        vector<Book> availableBooks;
-        copy_if(books.begin(), books.end(), back_inserter(availableBooks),
-                [](const Book& b) { return b.getAvailability(); });
-        return availableBooks;
-    }
-
-    // Get all borrowed books with their transaction details
-    vector<pair<Book, Transaction>> getBorrowedBooksWithTransactions() const {
-        vector<pair<Book, Transaction>> borrowedBooks;
-        for (const auto& book : books) {
-            if (!book.getAvailability()) {
-                auto it = find_if(transactions.rbegin(), transactions.rend(),
-                                  [&](const Transaction& t) { return t.getBookID() == book.getBookID() && t.getReturnDate() == 0; });
-                if (it != transactions.rend()) {
-                    borrowedBooks.push_back(make_pair(book, *it));
-                }
-            }
-        }
-        return borrowedBooks;
-    }
-
-
-    // Get members with overdue books and their fees
-    vector<pair<Member, double>> getOverdueMembers() const {
-        vector<pair<Member, double>> overdueMembers;
-        for (const auto& transaction : transactions) {
-            if (transaction.getReturnDate() == 0 && transaction.calculateOverdueDays() > 14) {
-                Member* member = const_cast<Library*>(this)->findMember(transaction.getMemberID());
-                if (member) {
-                    double overdueFee = transaction.calculateOverdueFees();
-                    overdueMembers.push_back(make_pair(*member, overdueFee));
-                }
-            }
-        }
-        return overdueMembers;
-    }
-};
-
-// Function to display the main menu
-void displayMenu() {
-    cout << "\nLibrary Management System\n";
-    cout << "1. Add Book\n";
-    cout << "2. Edit Book\n";
-    cout << "3. Delete Book\n";
-    cout << "4. View All Books\n";
-    cout << "5. Add Member\n";
-    cout << "6. Edit Member\n";
-    cout << "7. Delete Member\n";
-    cout << "8. View All Members\n";
-    cout << "9. Borrow Book\n";
-    cout << "10. Return Book\n";
-    cout << "11. Search Books\n";
-    cout << "12. Search Members\n";
-    cout << "13. View Available Books\n";
-    cout << "14. View Borrowed Books\n";
-    cout << "15. View Overdue Members\n";
-    cout << "16. Clear Screen\n";
-    cout << "0. Exit\n";
-    cout << "Enter your choice: ";
-}
-
-
-int main() {
-    Library library;
-    int choice;
-
-    do {
-        displayMenu();
-        cin >> choice;
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-
-        try {
-            switch (choice) {
-                case 1: {
-                    string id, title, author, genre;
-                    cout << "Enter Book ID: ";
-                    getline(cin, id);
-                    cout << "Enter Title: ";
-                    getline(cin, title);
-                    cout << "Enter Author: ";
-                    getline(cin, author);
-                    cout << "Enter Genre: ";
-                    getline(cin, genre);
-                    library.addBook(Book(id, title, author, genre));
-                    cout << "Book added successfully.\n";
-                    break;
-                }
-                case 2: {
-                    string id, title, author, genre;
-                    cout << "Enter Book ID to edit: ";
-                    getline(cin, id);
-                    cout << "Enter new Title: ";
-                    getline(cin, title);
-                    cout << "Enter new Author: ";
-                    getline(cin, author);
-                    cout << "Enter new Genre: ";
-                    getline(cin, genre);
-                    library.editBook(id, Book(id, title, author, genre));
-                    cout << "Book edited successfully.\n";
-                    break;
-                }
-                case 3: {
-                    string id;
-                    cout << "Enter Book ID to delete: ";
-                    getline(cin, id);
-                    library.deleteBook(id);
-                    cout << "Book deleted successfully.\n";
-                    break;
-                }
-                case 4: {
-                    auto books = library.getAllBooks();
-                    for (const auto& book : books) {
-                        cout << book.toString() << endl;
-                    }
-                    break;
-                }
-                case 5: {
-                    string id, name, address, phone;
-                    cout << "Enter Member ID: ";
-                    getline(cin, id);
-                    cout << "Enter Name: ";
-                    getline(cin, name);
-                    cout << "Enter Address: ";
-                    getline(cin, address);
-                    cout << "Enter Phone Number: ";
-                    getline(cin, phone);
-                    library.addMember(Member(id, name, address, phone));
-                    cout << "Member added successfully.\n";
-                    break;
-                }
-                case 6: {
-                    string id, name, address, phone;
-                    cout << "Enter Member ID to edit: ";
-                    getline(cin, id);
-                    cout << "Enter new Name: ";
-                    getline(cin, name);
-                    cout << "Enter new Address: ";
-                    getline(cin, address);
-                    cout << "Enter new Phone Number: ";
-                    getline(cin, phone);
-                    library.editMember(id, Member(id, name, address, phone));
-                    cout << "Member edited successfully.\n";
-                    break;
-                }
-                case 7: {
-                    string id;
-                    cout << "Enter Member ID to delete: ";
-                    getline(cin, id);
-                    library.deleteMember(id);
-                    cout << "Member deleted successfully.\n";
-                    break;
-                }
-                case 8: {
-                    auto members = library.getAllMembers();
-                    for (const auto& member : members) {
-                        cout << member.toString() << endl;
-                    }
-                    break;
-                }
-                case 9: {
-                    string memberID, bookID;
-                    cout << "Enter Member ID: ";
-                    getline(cin, memberID);
-                    cout << "Enter Book ID: ";
-                    getline(cin, bookID);
-                    string transactionID = library.borrowBook(memberID, bookID);
-                    cout << "Book borrowed successfully. Transaction ID: " << transactionID << endl;
-                    break;
-                }
-                case 10: {
-                    string bookIdentifier;
-                    cout << "Enter Book ID or Title to return: ";
-                    getline(cin, bookIdentifier);
-                    library.returnBook(bookIdentifier);
-                    cout << "Book returned successfully.\n";
-                    break;
-                }
-                case 11: {
-                    string query;
-                    cout << "Enter search query for books (ID or Title): ";
-                    getline(cin, query);
-                    auto results = library.searchBooks(query);
-                    for (const auto& book : results) {
-                        cout << book.toString() << endl;
-                    }
-                    break;
-                }
-                case 12: {
-                    string query;
-                    cout << "Enter search query for members (ID or Name): ";
-                    getline(cin, query);
-                    auto results = library.searchMembers(query);
-                    for (const auto& member : results) {
-                        cout << member.toString() << endl;
-                    }
-                    break;
-                }
-                case 13: {
-                    auto availableBooks = library.getAvailableBooks();
-                    for (const auto& book : availableBooks) {
-                        cout << book.toString() << endl;
-                    }
-                    break;
-                }
-                case 14: {
-                    auto borrowedBooks = library.getBorrowedBooksWithTransactions();
-                    if (borrowedBooks.empty()) {
-                        cout << "No books are currently borrowed." << endl;
-                    } else {
-                        cout << "Borrowed Books:" << endl;
-                        for (const auto& pair : borrowedBooks) {
-                            const Book& book = pair.first;
-                            const Transaction& transaction = pair.second;
-                            cout << "Book: " << book.getTitle() << " (ID: " << book.getBookID() << ")" << endl;
-                            cout << "  Borrowed by Member ID: " << transaction.getMemberID() << endl;
-                            cout << "  Transaction ID: " << transaction.getTransactionID() << endl;
-                            cout << "  Borrow Date: " << transaction.getFormattedBorrowDate() << endl;
-                            cout << "  Expected Return Date: " << transaction.getFormattedExpectedReturnDate() << endl;
-                            cout << "  Days Overdue: " << transaction.calculateOverdueDays() << endl;
-                            cout << "  Overdue Fee: KSH " << fixed << setprecision(2) << transaction.calculateOverdueFees() << endl;
-                            cout << endl;
-                        }
-                    }
-                    break;
-                }
-                case 15: {
-                    auto overdueMembers = library.getOverdueMembers();
-                    for (const auto& pair : overdueMembers) {
-                        cout << pair.first.toString() << " | Overdue Fee: $" << fixed << setprecision(2) << pair.second << endl;
-                    }
-                    break;
-                }
-                case 16: {
-                    clearScreen();
-                    break;
-                }
-                case 0:
-                    cout << "Exiting...\n";
-                    break;
-                default:
-                    cout << "Invalid choice. Please try again.\n";
-            }
-         } catch (const exception& e) {
-            cout << "Error: " << e.what() << endl;
-        }
-
-        if (choice != 0 && choice != 16) {
-            cout << "Press Enter to continue...";
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        }
-
-    } while (choice != 0);
-
-    return 0;
-}
-
-
-
+#include <iostream>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
+#include <cstring>
+#include <map>
+#include <set>
+#include <functional>
+#include <shared_mutex>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <exception>
+#include <csignal>
+#include <cstdint>
+#include <string_view>
+#include <filesystem>
+#include <charconv>
+#include <array>
+#include <cmath>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LMS_X86_SIMD 1
+#include <immintrin.h>
+#endif
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#endif
+
+using namespace std;
+
+// Function to clear the console screen
+void clearScreen() {
+    #ifdef _WIN32
+        system("cls");
+    #else
+        system("clear");
+    #endif
+}
+
+// Quote a CSV field if it contains a separator, quote or line break
+string csvField(const string& value) {
+    if (value.find_first_of(",\"\r\n") == string::npos) {
+        return value;
+    }
+    string quoted = "\"";
+    for (char c : value) {
+        if (c == '"') {
+            quoted += '"';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// CsvParser class to split CSV records in place, handling quoted fields
+class CsvParser {
+private:
+    vector<string_view> fields;
+    string scratch;                       // unescaped text of records containing quotes
+    vector<pair<size_t, size_t>> spans;   // field (offset, length) within scratch
+    bool terminated = false;
+
+    // Slow path for records containing quotes, which may also span several lines
+    const char* parseQuoted(const char* p, const char* end) {
+        scratch.clear();
+        spans.clear();
+        size_t start = 0;
+        bool quoted = false;
+        while (p < end) {
+            char c = *p++;
+            if (quoted) {
+                if (c != '"') {
+                    scratch += c;
+                } else if (p < end && *p == '"') {
+                    scratch += '"';
+                    p++;
+                } else {
+                    quoted = false;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == ',') {
+                spans.push_back(make_pair(start, scratch.size() - start));
+                start = scratch.size();
+            } else if (c == '\n') {
+                terminated = true;
+                break;
+            } else if (c != '\r' || (p < end && *p != '\n')) {
+                scratch += c;
+            }
+        }
+        spans.push_back(make_pair(start, scratch.size() - start));
+        for (const auto& span : spans) {
+            fields.push_back(string_view(scratch.data() + span.first, span.second));
+        }
+        return p;
+    }
+
+public:
+    // Parse the record starting at p; returns the position just after it
+    const char* parse(const char* p, const char* end) {
+        fields.clear();
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+        terminated = lineEnd != nullptr;
+        if (!lineEnd) {
+            lineEnd = end;
+        }
+        if (memchr(p, '"', lineEnd - p)) {
+            return parseQuoted(p, end);
+        }
+        const char* recordEnd = lineEnd > p && lineEnd[-1] == '\r' ? lineEnd - 1 : lineEnd;
+        while (true) {
+            const char* comma = static_cast<const char*>(memchr(p, ',', recordEnd - p));
+            if (!comma) {
+                fields.push_back(string_view(p, recordEnd - p));
+                break;
+            }
+            fields.push_back(string_view(p, comma - p));
+            p = comma + 1;
+        }
+        return terminated ? lineEnd + 1 : end;
+    }
+
+    size_t size() const { return fields.size(); }
+    bool empty() const { return fields.size() == 1 && fields[0].empty(); }
+    bool complete() const { return terminated; }  // the record ended with a line break
+
+    // Missing trailing fields read as empty
+    string_view operator[](size_t i) const { return i < fields.size() ? fields[i] : string_view(); }
+    string str(size_t i) const { return string((*this)[i]); }
+
+    // Parse a field as a signed integer; an empty field reads as 0
+    long long integer(size_t i) const {
+        string_view field = (*this)[i];
+        long long value = 0;
+        if (field.empty()) {
+            return value;
+        }
+        auto result = from_chars(field.data(), field.data() + field.size(), value);
+        if (result.ec != errc() || result.ptr != field.data() + field.size()) {
+            throw runtime_error("Invalid number \"" + string(field) + "\" in data file.");
+        }
+        return value;
+    }
+};
+
+// Split [begin, end) into about parts ranges that each start at a record boundary.
+// A line break only ends a record outside quotes, so a boundary goes after the first line
+// break past each target offset at which an even number of quote characters has been seen.
+vector<const char*> splitRecords(const char* begin, const char* end, size_t parts) {
+    vector<const char*> bounds(1, begin);
+    size_t quotes = 0;
+    const char* scanned = begin;
+    for (size_t k = 1; k < parts; k++) {
+        const char* target = begin + (end - begin) * k / parts;
+        if (target <= scanned) {
+            continue;
+        }
+        quotes += count(scanned, target, '"');
+        const char* p = target;
+        while (p < end && (*p != '\n' || quotes % 2 != 0)) {
+            quotes += *p++ == '"';
+        }
+        if (p >= end) {
+            break;
+        }
+        scanned = p + 1;
+        bounds.push_back(scanned);
+    }
+    bounds.push_back(end);
+    return bounds;
+}
+
+// Book class to represent a book in the library
+class Book {
+private:
+    string bookID;
+    string title;
+    string author;
+    string genre;
+    bool isAvailable;
+
+public:
+    Book(string id, string t, string a, string g)
+        : bookID(id), title(t), author(a), genre(g), isAvailable(true) {}
+
+    string getBookID() const { return bookID; }
+    string getTitle() const { return title; }
+    string getAuthor() const { return author; }
+    string getGenre() const { return genre; }
+    bool getAvailability() const { return isAvailable; }
+    void setAvailability(bool status) { isAvailable = status; }
+
+    string toString() const {
+        return csvField(bookID) + "," + csvField(title) + "," + csvField(author) + "," + csvField(genre) + "," +
+               (isAvailable ? "Available" : "Borrowed");
+    }
+};
+
+// Member class to represent a library member
+class Member {
+private:
+    string memberID;
+    string name;
+    string address;
+    string phoneNumber;
+
+public:
+    Member(string id, string n, string addr, string phone)
+        : memberID(id), name(n), address(addr), phoneNumber(phone) {}
+
+    string getMemberID() const { return memberID; }
+    string getName() const { return name; }
+    string getAddress() const { return address; }
+    string getPhoneNumber() const { return phoneNumber; }
+
+    string toString() const {
+        return csvField(memberID) + "," + csvField(name) + "," + csvField(address) + "," + csvField(phoneNumber);
+    }
+};
+
+// Transaction class to represent a book borrowing transaction
+class Transaction {
+private:
+    string transactionID;
+    string memberID;
+    string bookID;
+    time_t borrowDate;
+    time_t returnDate;
+    time_t expectedReturnDate;
+
+public:
+    static constexpr double DAILY_FEE = 100.0;  // KSH per overdue day
+
+    Transaction(string tID, string mID, string bID)
+        : transactionID(tID), memberID(mID), bookID(bID) {
+        borrowDate = time(nullptr);
+        returnDate = 0; // 0 indicates the book hasn't been returned yet
+        expectedReturnDate = borrowDate + (14 * 24 * 60 * 60); // 14 days from borrow date
+    }
+
+    // Restore a transaction exactly as it was recorded (used when loading and replaying)
+    Transaction(string tID, string mID, string bID, time_t borrowed, time_t returned, time_t expected)
+        : transactionID(tID), memberID(mID), bookID(bID),
+          borrowDate(borrowed), returnDate(returned), expectedReturnDate(expected) {}
+
+    string getTransactionID() const { return transactionID; }
+    string getMemberID() const { return memberID; }
+    string getBookID() const { return bookID; }
+    time_t getBorrowDate() const { return borrowDate; }
+    time_t getReturnDate() const { return returnDate; }
+    time_t getExpectedReturnDate() const { return expectedReturnDate; }
+    void setReturnDate(time_t date) { returnDate = date; }
+
+    int calculateOverdueDays() const {
+        return calculateOverdueDays(time(nullptr));
+    }
+
+    // Overdue days as of the given time
+    int calculateOverdueDays(time_t now) const {
+        return overdueDays(returnDate, expectedReturnDate, now);
+    }
+
+    // Overdue days of a loan due at expected and returned at returned (0 while still out), as of now
+    static int overdueDays(time_t returned, time_t expected, time_t now) {
+        if (returned == 0) {
+            return max(0, static_cast<int>((now - expected) / (24 * 60 * 60)));
+        }
+        return max(0, static_cast<int>((returned - expected) / (24 * 60 * 60)));
+    }
+
+    double calculateOverdueFees() const {
+        return calculateOverdueFees(time(nullptr));
+    }
+
+    double calculateOverdueFees(time_t now) const {
+        return calculateOverdueDays(now) * DAILY_FEE;
+    }
+
+    string toString() const {
+        stringstream ss;
+        ss << csvField(transactionID) << "," << csvField(memberID) << "," << csvField(bookID) << "," << borrowDate << "," << returnDate << "," << expectedReturnDate;
+        return ss.str();
+    }
+
+    static string getFormattedDate(time_t date) {
+        char buffer[26];
+        struct tm timeinfo;
+        #ifdef _WIN32
+            localtime_s(&timeinfo, &date);
+        #else
+            localtime_r(&date, &timeinfo);  // localtime() shares one buffer between threads
+        #endif
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d", &timeinfo);
+        return string(buffer);
+    }
+
+    string getFormattedBorrowDate() const {
+        return getFormattedDate(borrowDate);
+    }
+
+    string getFormattedExpectedReturnDate() const {
+        return getFormattedDate(expectedReturnDate);
+    }
+};
+
+// StringPool class to intern strings as 32-bit handles into a shared arena
+//
+// Strings are copied into fixed-size blocks that never move, so the views handed out
+// stay valid for the life of the pool.
+class StringPool {
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    vector<unique_ptr<char[]>> blocks;
+    char* current = nullptr;  // block being filled
+    size_t blockUsed = BLOCK_SIZE;
+    size_t arenaBytes = 0;
+    vector<string_view> strings;
+    // Open-addressing table of (hash << 32 | handle + 1); 0 marks an empty slot
+    vector<uint64_t> table;
+
+    void grow() {
+        vector<uint64_t> old(max<size_t>(1024, table.size() * 2), 0);
+        old.swap(table);
+        size_t mask = table.size() - 1;
+        for (uint64_t entry : old) {
+            if (entry) {
+                size_t i = (entry >> 32) & mask;
+                while (table[i]) {
+                    i = (i + 1) & mask;
+                }
+                table[i] = entry;
+            }
+        }
+    }
+
+    string_view store(string_view value) {
+        if (value.empty()) {
+            return string_view();
+        }
+        if (value.size() > BLOCK_SIZE / 4) {
+            // Long strings get a block of their own so they do not waste the tail of the current one
+            blocks.emplace_back(new char[value.size()]);
+            arenaBytes += value.size();
+            memcpy(blocks.back().get(), value.data(), value.size());
+            return string_view(blocks.back().get(), value.size());
+        }
+        if (value.size() > BLOCK_SIZE - blockUsed) {
+            blocks.emplace_back(new char[BLOCK_SIZE]);
+            current = blocks.back().get();
+            blockUsed = 0;
+            arenaBytes += BLOCK_SIZE;
+        }
+        char* copy = current + blockUsed;
+        memcpy(copy, value.data(), value.size());
+        blockUsed += value.size();
+        return string_view(copy, value.size());
+    }
+
+public:
+    StringPool() = default;
+    StringPool(StringPool&&) = default;
+    StringPool& operator=(StringPool&&) = default;
+
+    // Copies re-intern every string in handle order, so handles stay the same
+    StringPool(const StringPool& other) {
+        *this = other;
+    }
+
+    StringPool& operator=(const StringPool& other) {
+        if (this != &other) {
+            clear();
+            strings.reserve(other.strings.size());
+            for (string_view value : other.strings) {
+                intern(value);
+            }
+        }
+        return *this;
+    }
+
+    // Handle of the string, adding it to the pool the first time it is seen
+    uint32_t intern(string_view value) {
+        if ((strings.size() + 1) * 2 > table.size()) {
+            grow();
+        }
+        uint64_t hash = static_cast<uint32_t>(std::hash<string_view>()(value));
+        size_t mask = table.size() - 1;
+        size_t i = hash & mask;
+        for (; table[i]; i = (i + 1) & mask) {
+            uint32_t handle = static_cast<uint32_t>(table[i]) - 1;
+            if ((table[i] >> 32) == hash && strings[handle] == value) {
+                return handle;
+            }
+        }
+        if (strings.size() == numeric_limits<uint32_t>::max() - 1) {
+            throw runtime_error("String pool is full.");
+        }
+        uint32_t handle = static_cast<uint32_t>(strings.size());
+        strings.push_back(store(value));
+        table[i] = hash << 32 | (handle + 1);
+        return handle;
+    }
+
+    static constexpr uint32_t NOT_FOUND = numeric_limits<uint32_t>::max();
+
+    // Handle of a string already in the pool, or NOT_FOUND
+    uint32_t find(string_view value) const {
+        if (table.empty()) {
+            return NOT_FOUND;
+        }
+        uint64_t hash = static_cast<uint32_t>(std::hash<string_view>()(value));
+        size_t mask = table.size() - 1;
+        for (size_t i = hash & mask; table[i]; i = (i + 1) & mask) {
+            uint32_t handle = static_cast<uint32_t>(table[i]) - 1;
+            if ((table[i] >> 32) == hash && strings[handle] == value) {
+                return handle;
+            }
+        }
+        return NOT_FOUND;
+    }
+
+    string_view view(uint32_t handle) const { return strings[handle]; }
+    size_t size() const { return strings.size(); }
+
+    void clear() {
+        blocks.clear();
+        current = nullptr;
+        blockUsed = BLOCK_SIZE;
+        arenaBytes = 0;
+        strings.clear();
+        table.clear();
+    }
+
+    // Heap footprint: arena blocks, the handle array and the lookup table
+    size_t memoryUsage() const {
+        return arenaBytes + strings.capacity() * sizeof(string_view) + table.capacity() * sizeof(uint64_t);
+    }
+};
+
+// TransactionStore class to keep transactions column-wise with interned IDs
+//
+// Member and book IDs are pooled handles. Transaction IDs that are plain decimal numbers
+// (the ones the library assigns) are stored inline; anything else goes through the pool
+// with NON_NUMERIC_ID set.
+class TransactionStore {
+private:
+    static constexpr uint32_t NON_NUMERIC_ID = 0x80000000u;
+    StringPool pool;
+    vector<uint32_t> transactionIDs;
+    vector<uint32_t> memberIdx;
+    vector<uint32_t> bookIdx;
+    vector<int64_t> borrowDates;
+    vector<int64_t> returnDates;
+    vector<int64_t> expectedDates;
+
+    uint32_t encodeTransactionID(string_view id) {
+        uint32_t number = 0;
+        auto result = from_chars(id.data(), id.data() + id.size(), number);
+        bool canonical = result.ec == errc() && result.ptr == id.data() + id.size() && number < NON_NUMERIC_ID &&
+                         (id.size() == 1 || id[0] != '0');
+        return canonical ? number : (pool.intern(id) | NON_NUMERIC_ID);
+    }
+
+public:
+    size_t size() const { return memberIdx.size(); }
+    bool empty() const { return memberIdx.empty(); }
+
+    void reserve(size_t count) {
+        transactionIDs.reserve(count);
+        memberIdx.reserve(count);
+        bookIdx.reserve(count);
+        borrowDates.reserve(count);
+        returnDates.reserve(count);
+        expectedDates.reserve(count);
+    }
+
+    void clear() {
+        pool.clear();
+        transactionIDs.clear();
+        memberIdx.clear();
+        bookIdx.clear();
+        borrowDates.clear();
+        returnDates.clear();
+        expectedDates.clear();
+    }
+
+    void append(string_view tID, string_view mID, string_view bID, time_t borrowed, time_t returned,
+                time_t expected) {
+        transactionIDs.push_back(encodeTransactionID(tID));
+        memberIdx.push_back(pool.intern(mID));
+        bookIdx.push_back(pool.intern(bID));
+        borrowDates.push_back(borrowed);
+        returnDates.push_back(returned);
+        expectedDates.push_back(expected);
+    }
+
+    // Copy one record from another store
+    void append(const TransactionStore& other, size_t slot) {
+        append(other.transactionID(slot), other.memberID(slot), other.bookID(slot), other.borrowDate(slot),
+               other.returnDate(slot), other.expectedReturnDate(slot));
+    }
+
+    // Append every record of another store, interning each of its distinct strings once
+    void appendAll(const TransactionStore& other) {
+        const uint32_t unmapped = numeric_limits<uint32_t>::max();
+        vector<uint32_t> remap(other.pool.size(), unmapped);
+        auto translate = [&](uint32_t handle) {
+            if (remap[handle] == unmapped) {
+                remap[handle] = pool.intern(other.pool.view(handle));
+            }
+            return remap[handle];
+        };
+        reserve(size() + other.size());
+        for (size_t i = 0; i < other.size(); i++) {
+            uint32_t id = other.transactionIDs[i];
+            transactionIDs.push_back(id & NON_NUMERIC_ID ? translate(id & ~NON_NUMERIC_ID) | NON_NUMERIC_ID : id);
+            memberIdx.push_back(translate(other.memberIdx[i]));
+            bookIdx.push_back(translate(other.bookIdx[i]));
+        }
+        borrowDates.insert(borrowDates.end(), other.borrowDates.begin(), other.borrowDates.end());
+        returnDates.insert(returnDates.end(), other.returnDates.begin(), other.returnDates.end());
+        expectedDates.insert(expectedDates.end(), other.expectedDates.begin(), other.expectedDates.end());
+    }
+
+    // Drop the records for which drop(slot) is true, keeping the rest in order
+    template <typename Drop>
+    void removeIf(Drop drop) {
+        size_t kept = 0;
+        for (size_t slot = 0; slot < size(); slot++) {
+            if (drop(slot)) {
+                continue;
+            }
+            transactionIDs[kept] = transactionIDs[slot];
+            memberIdx[kept] = memberIdx[slot];
+            bookIdx[kept] = bookIdx[slot];
+            borrowDates[kept] = borrowDates[slot];
+            returnDates[kept] = returnDates[slot];
+            expectedDates[kept] = expectedDates[slot];
+            kept++;
+        }
+        transactionIDs.resize(kept);
+        memberIdx.resize(kept);
+        bookIdx.resize(kept);
+        borrowDates.resize(kept);
+        returnDates.resize(kept);
+        expectedDates.resize(kept);
+    }
+
+    void push_back(const Transaction& transaction) {
+        append(transaction.getTransactionID(), transaction.getMemberID(), transaction.getBookID(),
+               transaction.getBorrowDate(), transaction.getReturnDate(), transaction.getExpectedReturnDate());
+    }
+
+    string transactionID(size_t slot) const {
+        uint32_t id = transactionIDs[slot];
+        return id & NON_NUMERIC_ID ? string(pool.view(id & ~NON_NUMERIC_ID)) : to_string(id);
+    }
+    string_view memberID(size_t slot) const { return pool.view(memberIdx[slot]); }
+    string_view bookID(size_t slot) const { return pool.view(bookIdx[slot]); }
+
+    // Interned handles, for counting per member or book without building strings
+    uint32_t memberHandle(size_t slot) const { return memberIdx[slot]; }
+    uint32_t bookHandle(size_t slot) const { return bookIdx[slot]; }
+    size_t handleCount() const { return pool.size(); }
+    string_view handleText(uint32_t handle) const { return pool.view(handle); }
+    uint32_t findHandle(string_view id) const { return pool.find(id); }
+    time_t borrowDate(size_t slot) const { return borrowDates[slot]; }
+    time_t returnDate(size_t slot) const { return returnDates[slot]; }
+    time_t expectedReturnDate(size_t slot) const { return expectedDates[slot]; }
+    void setReturnDate(size_t slot, time_t date) { returnDates[slot] = date; }
+
+    // Materialize one record
+    Transaction operator[](size_t slot) const {
+        return Transaction(transactionID(slot), string(memberID(slot)), string(bookID(slot)), borrowDates[slot],
+                           returnDates[slot], expectedDates[slot]);
+    }
+
+    // Approximate heap footprint of the columns and the string pool
+    size_t memoryUsage() const {
+        return (transactionIDs.capacity() + memberIdx.capacity() + bookIdx.capacity()) * sizeof(uint32_t) +
+               (borrowDates.capacity() + returnDates.capacity() + expectedDates.capacity()) * sizeof(int64_t) +
+               pool.memoryUsage();
+    }
+};
+
+// TransactionRef class to read one stored transaction in place, without copying its IDs
+class TransactionRef {
+private:
+    const TransactionStore* store;
+    size_t slot;
+
+public:
+    TransactionRef(const TransactionStore& transactions, size_t index) : store(&transactions), slot(index) {}
+
+    string getTransactionID() const { return store->transactionID(slot); }
+    string_view getMemberID() const { return store->memberID(slot); }
+    string_view getBookID() const { return store->bookID(slot); }
+    time_t getBorrowDate() const { return store->borrowDate(slot); }
+    time_t getReturnDate() const { return store->returnDate(slot); }
+    time_t getExpectedReturnDate() const { return store->expectedReturnDate(slot); }
+
+    int calculateOverdueDays(time_t now = time(nullptr)) const {
+        return Transaction::overdueDays(getReturnDate(), getExpectedReturnDate(), now);
+    }
+
+    double calculateOverdueFees(time_t now = time(nullptr)) const {
+        return calculateOverdueDays(now) * Transaction::DAILY_FEE;
+    }
+
+    string getFormattedBorrowDate() const { return Transaction::getFormattedDate(getBorrowDate()); }
+    string getFormattedExpectedReturnDate() const { return Transaction::getFormattedDate(getExpectedReturnDate()); }
+
+    string toString() const { return (*store)[slot].toString(); }
+
+    // Copy the record out as a Transaction
+    Transaction toTransaction() const { return (*store)[slot]; }
+};
+
+// How the library persists its mutations to disk
+enum class PersistenceMode {
+    Snapshot,   // rewrite the affected data file after every mutation
+    Journal,    // append a record to the write-ahead log and compact it periodically
+    ReadOnly,   // load the data files but keep every mutation in memory only
+    None,       // keep everything in memory (benchmarks and scratch libraries)
+    Replica     // load the data files and follow another process's journal; local changes are rejected
+};
+
+// When journal records are forced to stable storage
+enum class SyncPolicy {
+    PerOperation,   // fsync after every record
+    GroupCommit,    // fsync once every groupCommitSize records
+    Periodic        // fsync when syncInterval has elapsed since the last sync
+};
+
+// On-disk format of the data files
+enum class DataFormat {
+    Text,   // books.txt, members.txt and transactions.txt
+    Binary  // library.bin, a columnar image that is memory-mapped at startup
+};
+
+// Options controlling how a Library is persisted
+struct LibraryOptions {
+    string dataDir;  // directory holding the data files (empty for the working directory)
+    DataFormat format = DataFormat::Text;
+    PersistenceMode persistence = PersistenceMode::Journal;
+    SyncPolicy syncPolicy = SyncPolicy::PerOperation;
+    size_t groupCommitSize = 32;
+    chrono::milliseconds syncInterval = chrono::milliseconds(1000);
+    size_t compactionThreshold = 10000;  // journal records before folding into the data files
+    bool threadSafe = false;  // serialise mutations and let reads run concurrently from several threads
+    size_t loadThreads = 0;   // threads for parsing the data files and building indexes at startup (0 = one per core)
+    size_t hotMonths = 3;     // closed loans borrowed before the last hotMonths calendar months move to archive/ (0 keeps all)
+    chrono::seconds snapshotTimeout = chrono::seconds(600);  // how long open snapshots may hold up archiving
+};
+
+// Metrics -------------------------------------------------------------------
+
+// Operations timed by the instrumentation layer
+enum class Metric {
+    AddBook, EditBook, DeleteBook, AddMember, EditMember, DeleteMember, BorrowBook, ReturnBook, BorrowBatch,
+    ReturnBatch, FindBook, FindMember, SearchBooks, SearchMembers, ListBooks, ListMembers, ListTransactions,
+    AvailableBooks, BorrowedBooks, ActiveLoans, OverdueMembers, MemberHistory, DateRange, CirculationReport, Import,
+    Export,
+    LoadData, BuildIndexes, ReplayJournal, JournalAppend, JournalSync, SaveData, Checkpoint, ArchiveLoans,
+    ReplicaApply, SnapshotRead, Count
+};
+
+const char* const METRIC_NAMES[] = {
+    "add_book", "edit_book", "delete_book", "add_member", "edit_member", "delete_member", "borrow_book",
+    "return_book", "borrow_batch", "return_batch", "find_book", "find_member", "search_books", "search_members",
+    "list_books", "list_members", "list_transactions", "available_books", "borrowed_books", "active_loans",
+    "overdue_members", "member_history", "date_range", "circulation_report", "import", "export", "load_data",
+    "build_indexes", "replay_journal", "journal_append", "journal_sync", "save_data", "checkpoint",
+    "archive_loans", "replica_apply", "snapshot_read"};
+
+// Running totals kept next to the timings
+enum class Counter { BytesWritten, RecordsLoaded, RecordsWritten, JournalRecords, Count };
+
+const char* const COUNTER_NAMES[] = {"bytes_written", "records_loaded", "records_written", "journal_records"};
+
+#ifndef LMS_DISABLE_METRICS
+
+// MetricsBlock class holding one thread's latency histograms and counters. Only the owning thread
+// writes to a block, so updates are relaxed loads and stores with no locked instructions; a reader
+// aggregating concurrently may miss the update in flight.
+class MetricsBlock {
+public:
+    // Four buckets per power of two: a bucket's midpoint is within 12.5% of any value in it
+    static constexpr size_t BUCKETS = 256;
+
+    struct Timing {
+        atomic<uint64_t> buckets[BUCKETS];
+        atomic<uint64_t> count;
+        atomic<uint64_t> totalNs;
+        atomic<uint64_t> maxNs;
+    };
+
+    Timing timings[static_cast<size_t>(Metric::Count)];
+    atomic<uint64_t> counters[static_cast<size_t>(Counter::Count)];
+
+    static void bump(atomic<uint64_t>& value, uint64_t amount) {
+        value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+
+    static size_t bucketOf(uint64_t ns) {
+        if (ns < 4) {
+            return static_cast<size_t>(ns);
+        }
+#ifdef __GNUC__
+        int msb = 63 - __builtin_clzll(ns);
+#else
+        int msb = 0;
+        while (ns >> (msb + 1)) {
+            msb++;
+        }
+#endif
+        return static_cast<size_t>(4 * (msb - 1) + ((ns >> (msb - 2)) & 3));
+    }
+
+    // Midpoint of the values that fall into a bucket
+    static uint64_t bucketValue(size_t bucket) {
+        if (bucket < 4) {
+            return bucket;
+        }
+        int shift = static_cast<int>(bucket / 4) - 1;
+        uint64_t low = (4 + bucket % 4) << shift;
+        return low + (uint64_t(1) << shift) / 2;
+    }
+
+    void record(Metric metric, uint64_t ns) {
+        Timing& timing = timings[static_cast<size_t>(metric)];
+        bump(timing.buckets[bucketOf(ns)], 1);
+        bump(timing.count, 1);
+        bump(timing.totalNs, ns);
+        if (ns > timing.maxNs.load(memory_order_relaxed)) {
+            timing.maxNs.store(ns, memory_order_relaxed);
+        }
+    }
+
+    void add(Counter counter, uint64_t amount) {
+        bump(counters[static_cast<size_t>(counter)], amount);
+    }
+};
+
+// MetricsRegistry class to hand each thread its own block and aggregate the blocks on demand
+class MetricsRegistry {
+private:
+    mutex blocksMutex;  // taken only when a thread starts or exits, and when reporting
+    vector<unique_ptr<MetricsBlock>> blocks;
+    vector<MetricsBlock*> idle;  // blocks of exited threads; reused with their totals by new threads
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+    // Returns the thread's block to the registry when the thread exits
+    struct Lease {
+        MetricsBlock* block = nullptr;
+
+        ~Lease() {
+            if (block) {
+                MetricsRegistry& registry = instance();
+                lock_guard<mutex> lock(registry.blocksMutex);
+                registry.idle.push_back(block);
+            }
+        }
+    };
+
+    MetricsBlock* acquire() {
+        lock_guard<mutex> lock(blocksMutex);
+        if (!idle.empty()) {
+            MetricsBlock* block = idle.back();
+            idle.pop_back();
+            return block;
+        }
+        blocks.emplace_back(new MetricsBlock());  // value-initialised: every figure starts at zero
+        return blocks.back().get();
+    }
+
+public:
+    // Never destroyed, so threads still running during shutdown can record safely
+    static MetricsRegistry& instance() {
+        static MetricsRegistry* registry = new MetricsRegistry();
+        return *registry;
+    }
+
+    MetricsBlock& local() {
+        thread_local Lease lease;
+        if (!lease.block) {
+            lease.block = acquire();
+        }
+        return *lease.block;
+    }
+
+    // Every thread's figures summed, formatted as an aligned table or one JSON object
+    string report(bool json) {
+        const size_t metricCount = static_cast<size_t>(Metric::Count);
+        const size_t counterCount = static_cast<size_t>(Counter::Count);
+        vector<array<uint64_t, MetricsBlock::BUCKETS>> buckets(metricCount);
+        vector<uint64_t> counts(metricCount), totals(metricCount), maxima(metricCount), counters(counterCount);
+        {
+            lock_guard<mutex> lock(blocksMutex);
+            for (auto& bucket : buckets) {
+                bucket.fill(0);
+            }
+            for (const auto& block : blocks) {
+                for (size_t m = 0; m < metricCount; m++) {
+                    const MetricsBlock::Timing& timing = block->timings[m];
+                    for (size_t b = 0; b < MetricsBlock::BUCKETS; b++) {
+                        buckets[m][b] += timing.buckets[b].load(memory_order_relaxed);
+                    }
+                    counts[m] += timing.count.load(memory_order_relaxed);
+                    totals[m] += timing.totalNs.load(memory_order_relaxed);
+                    maxima[m] = max(maxima[m], timing.maxNs.load(memory_order_relaxed));
+                }
+                for (size_t c = 0; c < counterCount; c++) {
+                    counters[c] += block->counters[c].load(memory_order_relaxed);
+                }
+            }
+        }
+        // Latency in microseconds below which the fraction p of the recorded calls fall
+        auto percentile = [&](size_t m, double p) {
+            uint64_t samples = 0;
+            for (uint64_t n : buckets[m]) {
+                samples += n;
+            }
+            uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(ceil(p * samples)));
+            uint64_t seen = 0;
+            for (size_t b = 0; b < MetricsBlock::BUCKETS; b++) {
+                seen += buckets[m][b];
+                if (seen >= rank) {
+                    return min(MetricsBlock::bucketValue(b), maxima[m]) / 1e3;
+                }
+            }
+            return maxima[m] / 1e3;
+        };
+        double uptimeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+
+        stringstream out;
+        out << fixed << setprecision(1);
+        if (json) {
+            out << "{\"uptime_ms\":" << uptimeMs << ",\"operations\":{";
+            bool first = true;
+            for (size_t m = 0; m < metricCount; m++) {
+                if (counts[m] == 0) {
+                    continue;
+                }
+                out << (first ? "" : ",") << '"' << METRIC_NAMES[m] << "\":{\"count\":" << counts[m]
+                    << ",\"p50_us\":" << percentile(m, 0.50) << ",\"p99_us\":" << percentile(m, 0.99)
+                    << ",\"max_us\":" << maxima[m] / 1e3 << ",\"total_ms\":" << totals[m] / 1e6 << '}';
+                first = false;
+            }
+            out << "},\"counters\":{";
+            for (size_t c = 0; c < counterCount; c++) {
+                out << (c ? "," : "") << '"' << COUNTER_NAMES[c] << "\":" << counters[c];
+            }
+            out << "}}\n";
+            return out.str();
+        }
+        out << "Uptime: " << uptimeMs / 1e3 << " s\n";
+        out << left << setw(20) << "operation" << right << setw(12) << "count" << setw(12) << "p50 us" << setw(12)
+            << "p99 us" << setw(12) << "max us" << setw(12) << "total ms" << '\n';
+        for (size_t m = 0; m < metricCount; m++) {
+            if (counts[m] == 0) {
+                continue;
+            }
+            out << left << setw(20) << METRIC_NAMES[m] << right << setw(12) << counts[m] << setw(12)
+                << percentile(m, 0.50) << setw(12) << percentile(m, 0.99) << setw(12) << maxima[m] / 1e3 << setw(12)
+                << totals[m] / 1e6 << '\n';
+        }
+        for (size_t c = 0; c < counterCount; c++) {
+            out << left << setw(20) << COUNTER_NAMES[c] << right << setw(12) << counters[c] << '\n';
+        }
+        return out.str();
+    }
+};
+
+// ScopedTimer class to record the time until the end of the enclosing scope
+class ScopedTimer {
+private:
+    Metric metric;
+    chrono::steady_clock::time_point start;
+
+public:
+    explicit ScopedTimer(Metric timed) : metric(timed), start(chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        MetricsRegistry::instance().local().record(metric, static_cast<uint64_t>(ns));
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+// Time the rest of the enclosing scope as the given Metric (one per scope)
+#define LMS_TIME(name) ScopedTimer scopedTimer(Metric::name)
+// Add to the given Counter
+#define LMS_COUNT(name, amount) MetricsRegistry::instance().local().add(Counter::name, (amount))
+
+string metricsReport(bool json) {
+    return MetricsRegistry::instance().report(json);
+}
+
+#else
+
+#define LMS_TIME(name) ((void)0)
+#define LMS_COUNT(name, amount) ((void)0)
+
+string metricsReport(bool json) {
+    return json ? "{\"enabled\":false}\n" : "Metrics are disabled in this build.\n";
+}
+
+#endif
+
+// Build the path of a data file inside a data directory
+string dataPath(const string& dir, const string& name) {
+    return dir.empty() ? name : dir + "/" + name;
+}
+
+// Force a file's (or directory's) contents to stable storage
+void syncPath(const string& path) {
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+#else
+    (void)path;
+#endif
+}
+
+// Write the next version of a file to path.tmp and force it to disk; publishFile moves it into place
+template <typename Write>
+void stageFile(const string& path, Write write) {
+    string temporary = path + ".tmp";
+    {
+        ofstream file(temporary, ios::binary | ios::trunc);
+        if (!file) {
+            throw runtime_error("Unable to write " + path + ".");
+        }
+        write(file);
+        file.flush();
+        if (!file) {
+            throw runtime_error("Unable to write " + path + ".");
+        }
+        LMS_COUNT(BytesWritten, static_cast<uint64_t>(file.tellp()));
+    }
+    syncPath(temporary);
+}
+
+// Rename a staged file over the original (atomic on POSIX) and sync the directory entry
+void publishFile(const string& path) {
+    filesystem::rename(path + ".tmp", path);
+    string dir = filesystem::path(path).parent_path().string();
+    syncPath(dir.empty() ? "." : dir);
+}
+
+// Replace a file so that a crash leaves either the old or the new contents, never a torn file
+template <typename Write>
+void writeFileAtomically(const string& path, Write write) {
+    stageFile(path, write);
+    publishFile(path);
+}
+
+// Months since year 0 of a timestamp's UTC calendar month (year * 12 + month - 1), computed
+// arithmetically from the day number so it is cheap enough to call once per loan
+long monthIndex(time_t date) {
+    long days = static_cast<long>(date >= 0 ? date / 86400 : (date - 86399) / 86400) + 719468;
+    long era = (days >= 0 ? days : days - 146096) / 146097;
+    long dayOfEra = days - era * 146097;
+    long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    long shifted = (5 * dayOfYear + 2) / 153;  // March-based month
+    long month = shifted < 10 ? shifted + 3 : shifted - 9;
+    long year = yearOfEra + era * 400 + (month <= 2);
+    return year * 12 + month - 1;
+}
+
+// Format a month index as "YYYY-MM"
+string monthName(long index) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%04ld-%02ld", index / 12, index % 12 + 1);
+    return buffer;
+}
+
+// Calendar month (UTC) of a timestamp as "YYYY-MM", optionally stepped back a number of months
+string monthOf(time_t date, size_t monthsBack = 0) {
+    return monthName(monthIndex(date) - static_cast<long>(monthsBack));
+}
+
+// Parse a date given as "YYYY-MM-DD" (local midnight, the time zone dates are displayed in) or as
+// seconds since the epoch
+time_t parseDate(const string& text) {
+    int year = 0;
+    int month = 0;
+    int day = 0;
+    char extra;
+    if (sscanf(text.c_str(), "%d-%d-%d%c", &year, &month, &day, &extra) == 3) {
+        struct tm timeinfo = {};
+        timeinfo.tm_year = year - 1900;
+        timeinfo.tm_mon = month - 1;
+        timeinfo.tm_mday = day;
+        timeinfo.tm_isdst = -1;  // let the C library decide whether daylight saving time applies
+        time_t date = mktime(&timeinfo);
+        // mktime normalizes out-of-range fields (2024-02-31 becomes 2024-03-02), so reject those
+        if (date == static_cast<time_t>(-1) || timeinfo.tm_year != year - 1900 || timeinfo.tm_mon != month - 1 ||
+            timeinfo.tm_mday != day) {
+            throw runtime_error("Invalid date " + text + "; use YYYY-MM-DD.");
+        }
+        return date;
+    }
+    size_t used = 0;
+    long long seconds = 0;
+    try {
+        seconds = stoll(text, &used);
+    } catch (const exception&) {
+        used = 0;
+    }
+    if (used == 0 || used != text.size()) {
+        throw runtime_error("Invalid date " + text + "; use YYYY-MM-DD.");
+    }
+    return static_cast<time_t>(seconds);
+}
+
+// MappedFile class to map a whole file read-only into memory
+class MappedFile {
+private:
+    const char* bytes;
+    size_t length;
+    #ifdef _WIN32
+        vector<char> buffer;
+    #endif
+
+public:
+    explicit MappedFile(const string& path) : bytes(nullptr), length(0) {
+        #ifdef _WIN32
+            ifstream file(path, ios::binary);
+            if (!file) {
+                throw runtime_error("Unable to open " + path + ".");
+            }
+            buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+            bytes = buffer.data();
+            length = buffer.size();
+        #else
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw runtime_error("Unable to open " + path + ".");
+            }
+            struct stat info;
+            if (fstat(fd, &info) != 0) {
+                close(fd);
+                throw runtime_error("Unable to stat " + path + ".");
+            }
+            length = static_cast<size_t>(info.st_size);
+            if (length > 0) {
+                void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped == MAP_FAILED) {
+                    close(fd);
+                    throw runtime_error("Unable to map " + path + ".");
+                }
+                bytes = static_cast<const char*>(mapped);
+            }
+            close(fd);
+        #endif
+    }
+
+    ~MappedFile() {
+        #ifndef _WIN32
+            if (bytes) {
+                munmap(const_cast<char*>(bytes), length);
+            }
+        #endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Binary catalog layout (native byte order):
+//   header | book columns | member columns | transaction columns | string heap
+// String columns hold (offset, length) references into the heap; dates are int64 columns.
+namespace binary {
+    const char MAGIC[8] = {'L', 'M', 'S', 'B', 'I', 'N', '\0', '\0'};
+    const uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t bookCount;
+        uint64_t memberCount;
+        uint64_t transactionCount;
+        uint64_t heapSize;
+    };
+
+    struct StringRef {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    // Round a section size up to keep every column 8-byte aligned
+    inline size_t align8(size_t n) { return (n + 7) & ~static_cast<size_t>(7); }
+
+    inline size_t bookSectionSize(uint64_t n) { return align8(4 * n * sizeof(StringRef) + n); }
+    inline size_t memberSectionSize(uint64_t n) { return 4 * n * sizeof(StringRef); }
+    inline size_t transactionSectionSize(uint64_t n) { return 3 * n * sizeof(StringRef) + 3 * n * sizeof(int64_t); }
+}
+
+// BinaryCatalogView class to read a memory-mapped binary catalog in place, without parsing
+class BinaryCatalogView {
+private:
+    MappedFile file;
+    const binary::Header* header;
+    const binary::StringRef* bookColumns;
+    const uint8_t* bookAvailable;
+    const binary::StringRef* memberColumns;
+    const binary::StringRef* transactionColumns;
+    const int64_t* dateColumns;
+    const char* heap;
+
+    string_view text(const binary::StringRef* column, size_t i) const {
+        return string_view(heap + column[i].offset, column[i].length);
+    }
+
+    void checkRefs(const binary::StringRef* refs, size_t count) const {
+        for (size_t i = 0; i < count; i++) {
+            if (static_cast<uint64_t>(refs[i].offset) + refs[i].length > header->heapSize) {
+                throw runtime_error("Corrupt binary catalog: string outside heap.");
+            }
+        }
+    }
+
+public:
+    explicit BinaryCatalogView(const string& path) : file(path) {
+        if (file.size() < sizeof(binary::Header)) {
+            throw runtime_error("Corrupt binary catalog: truncated header.");
+        }
+        header = reinterpret_cast<const binary::Header*>(file.data());
+        if (memcmp(header->magic, binary::MAGIC, sizeof(binary::MAGIC)) != 0) {
+            throw runtime_error("Not a binary library catalog: " + path + ".");
+        }
+        if (header->version != binary::VERSION) {
+            throw runtime_error("Unsupported binary catalog version " + to_string(header->version) + ".");
+        }
+        // Check each count against the bytes left before multiplying it into a section size, so a
+        // corrupt header cannot overflow the offsets and point the columns outside the mapping
+        size_t remaining = file.size() - sizeof(binary::Header);
+        auto section = [&remaining](uint64_t count, size_t recordSize, size_t (*sectionSize)(uint64_t)) {
+            if (count > remaining / recordSize || sectionSize(count) > remaining) {
+                throw runtime_error("Corrupt binary catalog: truncated file.");
+            }
+            remaining -= sectionSize(count);
+            return sectionSize(count);
+        };
+        size_t bookOffset = sizeof(binary::Header);
+        size_t memberOffset = bookOffset + section(header->bookCount, 4 * sizeof(binary::StringRef) + 1,
+                                                   binary::bookSectionSize);
+        size_t transactionOffset = memberOffset + section(header->memberCount, 4 * sizeof(binary::StringRef),
+                                                          binary::memberSectionSize);
+        size_t heapOffset = transactionOffset + section(header->transactionCount,
+                                                        3 * sizeof(binary::StringRef) + 3 * sizeof(int64_t),
+                                                        binary::transactionSectionSize);
+        if (header->heapSize > remaining) {
+            throw runtime_error("Corrupt binary catalog: truncated file.");
+        }
+        const char* base = file.data();
+        bookColumns = reinterpret_cast<const binary::StringRef*>(base + bookOffset);
+        bookAvailable = reinterpret_cast<const uint8_t*>(bookColumns + 4 * header->bookCount);
+        memberColumns = reinterpret_cast<const binary::StringRef*>(base + memberOffset);
+        transactionColumns = reinterpret_cast<const binary::StringRef*>(base + transactionOffset);
+        dateColumns = reinterpret_cast<const int64_t*>(transactionColumns + 3 * header->transactionCount);
+        heap = base + heapOffset;
+        checkRefs(bookColumns, 4 * header->bookCount);
+        checkRefs(memberColumns, 4 * header->memberCount);
+        checkRefs(transactionColumns, 3 * header->transactionCount);
+    }
+
+    size_t bookCount() const { return header->bookCount; }
+    string_view bookID(size_t i) const { return text(bookColumns, i); }
+    string_view bookTitle(size_t i) const { return text(bookColumns + header->bookCount, i); }
+    string_view bookAuthor(size_t i) const { return text(bookColumns + 2 * header->bookCount, i); }
+    string_view bookGenre(size_t i) const { return text(bookColumns + 3 * header->bookCount, i); }
+    bool bookIsAvailable(size_t i) const { return bookAvailable[i] != 0; }
+
+    size_t memberCount() const { return header->memberCount; }
+    string_view memberID(size_t i) const { return text(memberColumns, i); }
+    string_view memberName(size_t i) const { return text(memberColumns + header->memberCount, i); }
+    string_view memberAddress(size_t i) const { return text(memberColumns + 2 * header->memberCount, i); }
+    string_view memberPhone(size_t i) const { return text(memberColumns + 3 * header->memberCount, i); }
+
+    size_t transactionCount() const { return header->transactionCount; }
+    string_view transactionID(size_t i) const { return text(transactionColumns, i); }
+    string_view transactionMemberID(size_t i) const { return text(transactionColumns + header->transactionCount, i); }
+    string_view transactionBookID(size_t i) const { return text(transactionColumns + 2 * header->transactionCount, i); }
+    time_t borrowDate(size_t i) const { return dateColumns[i]; }
+    time_t returnDate(size_t i) const { return dateColumns[header->transactionCount + i]; }
+    time_t expectedReturnDate(size_t i) const { return dateColumns[2 * header->transactionCount + i]; }
+};
+
+// BinaryCatalogWriter class to lay out records as columns plus a shared string heap
+class BinaryCatalogWriter {
+private:
+    string heap;
+    vector<binary::StringRef> bookColumns[4];
+    vector<uint8_t> bookAvailable;
+    vector<binary::StringRef> memberColumns[4];
+    vector<binary::StringRef> transactionColumns[3];
+    vector<int64_t> dateColumns[3];
+
+    binary::StringRef intern(const string& value) {
+        if (heap.size() + value.size() > numeric_limits<uint32_t>::max()) {
+            throw runtime_error("Binary catalog string heap exceeds 4 GiB.");
+        }
+        binary::StringRef ref = {static_cast<uint32_t>(heap.size()), static_cast<uint32_t>(value.size())};
+        heap += value;
+        return ref;
+    }
+
+    template <typename T>
+    static void writeColumn(ostream& out, const vector<T>& column) {
+        out.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+    }
+
+public:
+    void addBook(const Book& book) {
+        bookColumns[0].push_back(intern(book.getBookID()));
+        bookColumns[1].push_back(intern(book.getTitle()));
+        bookColumns[2].push_back(intern(book.getAuthor()));
+        bookColumns[3].push_back(intern(book.getGenre()));
+        bookAvailable.push_back(book.getAvailability() ? 1 : 0);
+    }
+
+    void addMember(const Member& member) {
+        memberColumns[0].push_back(intern(member.getMemberID()));
+        memberColumns[1].push_back(intern(member.getName()));
+        memberColumns[2].push_back(intern(member.getAddress()));
+        memberColumns[3].push_back(intern(member.getPhoneNumber()));
+    }
+
+    void addTransaction(const Transaction& transaction) {
+        transactionColumns[0].push_back(intern(transaction.getTransactionID()));
+        transactionColumns[1].push_back(intern(transaction.getMemberID()));
+        transactionColumns[2].push_back(intern(transaction.getBookID()));
+        dateColumns[0].push_back(transaction.getBorrowDate());
+        dateColumns[1].push_back(transaction.getReturnDate());
+        dateColumns[2].push_back(transaction.getExpectedReturnDate());
+    }
+
+    void write(const string& path) const {
+        stage(path);
+        publishFile(path);
+    }
+
+    // Write the catalog to path.tmp for publishFile to move into place later
+    void stage(const string& path) const {
+        stageFile(path, [this](ofstream& out) { write(out); });
+    }
+
+    void write(ostream& out) const {
+        binary::Header header = {};
+        memcpy(header.magic, binary::MAGIC, sizeof(binary::MAGIC));
+        header.version = binary::VERSION;
+        header.bookCount = bookAvailable.size();
+        header.memberCount = memberColumns[0].size();
+        header.transactionCount = dateColumns[0].size();
+        header.heapSize = heap.size();
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& column : bookColumns) {
+            writeColumn(out, column);
+        }
+        writeColumn(out, bookAvailable);
+        size_t written = 4 * bookAvailable.size() * sizeof(binary::StringRef) + bookAvailable.size();
+        out.write("\0\0\0\0\0\0\0", binary::align8(written) - written);
+        for (const auto& column : memberColumns) {
+            writeColumn(out, column);
+        }
+        for (const auto& column : transactionColumns) {
+            writeColumn(out, column);
+        }
+        for (const auto& column : dateColumns) {
+            writeColumn(out, column);
+        }
+        out.write(heap.data(), heap.size());
+    }
+};
+
+// ThreadPool class to run submitted tasks on a fixed set of worker threads
+class ThreadPool {
+private:
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    mutex tasksMutex;
+    condition_variable tasksReady;
+    bool stopping = false;
+
+public:
+    explicit ThreadPool(size_t threadCount) {
+        for (size_t i = 0; i < max<size_t>(threadCount, 1); i++) {
+            workers.emplace_back([this] {
+                while (true) {
+                    function<void()> task;
+                    {
+                        unique_lock<mutex> lock(tasksMutex);
+                        tasksReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+                        if (tasks.empty()) {
+                            return;
+                        }
+                        task = move(tasks.front());
+                        tasks.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    ~ThreadPool() {
+        shutdown();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(function<void()> task) {
+        {
+            lock_guard<mutex> lock(tasksMutex);
+            tasks.push_back(move(task));
+        }
+        tasksReady.notify_one();
+    }
+
+    // Finish the queued tasks and join the workers
+    void shutdown() {
+        {
+            lock_guard<mutex> lock(tasksMutex);
+            stopping = true;
+        }
+        tasksReady.notify_all();
+        for (auto& worker : workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+    }
+
+    size_t size() const { return workers.size(); }
+};
+
+// Run tasks on up to threadCount workers and wait for all of them; rethrows the first failure
+void runParallel(size_t threadCount, vector<function<void()>> tasks) {
+    if (threadCount <= 1 || tasks.size() <= 1) {
+        for (auto& task : tasks) {
+            task();
+        }
+        return;
+    }
+    exception_ptr failure;
+    mutex failureMutex;
+    {
+        ThreadPool pool(min(threadCount, tasks.size()));
+        for (auto& task : tasks) {
+            pool.submit([&task, &failure, &failureMutex] {
+                try {
+                    task();
+                } catch (...) {
+                    lock_guard<mutex> lock(failureMutex);
+                    if (!failure) {
+                        failure = current_exception();
+                    }
+                }
+            });
+        }
+        pool.shutdown();
+    }
+    if (failure) {
+        rethrow_exception(failure);
+    }
+}
+
+// Journal class to append mutation records to the write-ahead log. Each record is written to the
+// file as it is appended, so it survives a process crash and a replica tailing the file sees it at
+// once; only the fsync is deferred by the sync policy. A write or sync that fails is taken back:
+// the caller's record is cut off the file and records written before it are kept for the next sync.
+class Journal {
+private:
+    FILE* file;
+    LibraryOptions options;
+    size_t unsyncedRecords;
+    long long writtenSize;   // bytes of the file holding complete records
+    long long durableSize;   // bytes of the file forced to stable storage
+    chrono::steady_clock::time_point lastSync;
+    mutex journalMutex;      // appends and the background flusher
+    condition_variable flusherWake;
+    bool stopping;
+    thread flusher;
+
+    static FILE* openFile(const string& path) {
+        FILE* opened = fopen(path.c_str(), "a");
+        if (opened) {
+            setvbuf(opened, nullptr, _IONBF, 0);
+            fseek(opened, 0, SEEK_END);
+        }
+        return opened;
+    }
+
+    void open(const string& path) {
+        file = openFile(path);
+        if (!file) {
+            throw runtime_error("Unable to open journal file " + path + ".");
+        }
+        writtenSize = durableSize = ftell(file);
+    }
+
+    // Whether the sync policy asks for a sync after this append
+    bool syncDue() const {
+        switch (options.syncPolicy) {
+            case SyncPolicy::PerOperation:
+                return true;
+            case SyncPolicy::GroupCommit:
+                return unsyncedRecords >= options.groupCommitSize;
+            case SyncPolicy::Periodic:
+                return chrono::steady_clock::now() - lastSync >= options.syncInterval;
+        }
+        return true;
+    }
+
+    // Cut the file back to size bytes, removing a record that was not (fully) written or synced
+    void cutBack(long long size) {
+        clearerr(file);
+        #ifndef _WIN32
+            if (ftruncate(fileno(file), size) != 0) {
+                throw runtime_error("Unable to write to journal, and unable to remove the partial write.");
+            }
+        #endif
+        writtenSize = size;
+    }
+
+    // Force the written records to stable storage (caller holds journalMutex)
+    void syncLocked() {
+        if (writtenSize == durableSize) {
+            return;
+        }
+        if (!file) {
+            throw runtime_error("The journal file is not open.");
+        }
+        LMS_TIME(JournalSync);
+        #ifndef _WIN32
+            if (fsync(fileno(file)) != 0) {
+                throw runtime_error("Unable to sync the journal.");
+            }
+        #endif
+        durableSize = writtenSize;
+        unsyncedRecords = 0;
+        lastSync = chrono::steady_clock::now();
+    }
+
+    // Write records to the file and sync if the policy says so; if either fails they are cut off again
+    void appendRecords(const string* first, const string* last, bool forceSync) {
+        string block;
+        for (const string* record = first; record != last; ++record) {
+            block += *record;
+            block += '\n';
+        }
+        size_t count = static_cast<size_t>(last - first);
+        lock_guard<mutex> lock(journalMutex);
+        if (!file) {
+            throw runtime_error("The journal file is not open.");
+        }
+        long long mark = writtenSize;
+        if (fwrite(block.data(), 1, block.size(), file) != block.size()) {
+            cutBack(mark);
+            throw runtime_error("Unable to write to journal.");
+        }
+        writtenSize += static_cast<long long>(block.size());
+        unsyncedRecords += count;
+        if (forceSync || syncDue()) {
+            try {
+                syncLocked();
+            } catch (...) {
+                cutBack(mark);
+                unsyncedRecords -= count;
+                throw;
+            }
+        }
+        LMS_COUNT(JournalRecords, static_cast<uint64_t>(count));
+        LMS_COUNT(BytesWritten, block.size());
+    }
+
+    // Sync records left unsynced for syncInterval, so group commit and periodic sync bound how long
+    // an acknowledged record stays exposed to power loss even when appends stop
+    void runFlusher() {
+        unique_lock<mutex> lock(journalMutex);
+        while (!stopping) {
+            flusherWake.wait_for(lock, options.syncInterval);
+            if (stopping || writtenSize == durableSize ||
+                chrono::steady_clock::now() - lastSync < options.syncInterval) {
+                continue;
+            }
+            try {
+                syncLocked();
+            } catch (const exception& e) {
+                cerr << "Error: " << e.what() << endl;
+            }
+        }
+    }
+
+public:
+    Journal(const string& path, const LibraryOptions& opts)
+        : file(nullptr), options(opts), unsyncedRecords(0), writtenSize(0), durableSize(0),
+          lastSync(chrono::steady_clock::now()), stopping(false) {
+        open(path);
+        if (options.syncPolicy != SyncPolicy::PerOperation) {
+            flusher = thread([this] { runFlusher(); });
+        }
+    }
+
+    ~Journal() {
+        if (flusher.joinable()) {
+            {
+                lock_guard<mutex> lock(journalMutex);
+                stopping = true;
+            }
+            flusherWake.notify_all();
+            flusher.join();
+        }
+        if (!file) {
+            return;
+        }
+        try {
+            sync();
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+        }
+        fclose(file);
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Append one record and sync it according to the configured policy. Throws, leaving the record
+    // out of the log, if writing it or a sync it triggers fails.
+    void append(const string& record) {
+        LMS_TIME(JournalAppend);
+        appendRecords(&record, &record + 1, false);
+    }
+
+    // Append several records as one operation: written together and synced once
+    void append(const vector<string>& records) {
+        LMS_TIME(JournalAppend);
+        appendRecords(records.data(), records.data() + records.size(), true);
+    }
+
+    // Force every written record to stable storage
+    void sync() {
+        lock_guard<mutex> lock(journalMutex);
+        syncLocked();
+    }
+
+    // Sync and move the current log aside as rotatedPath, then continue in a fresh file at path. If
+    // the move or the new file fails, appends carry on in the current file.
+    void rotate(const string& path, const string& rotatedPath) {
+        lock_guard<mutex> lock(journalMutex);
+        syncLocked();
+        #ifdef _WIN32
+            // An open file cannot be renamed here: close it first and reopen the log if the move fails
+            fclose(file);
+            file = nullptr;
+            try {
+                filesystem::rename(path, rotatedPath);
+            } catch (...) {
+                open(path);
+                throw;
+            }
+            open(path);
+        #else
+            filesystem::rename(path, rotatedPath);  // the open handle follows the renamed file
+            FILE* fresh = openFile(path);
+            if (!fresh) {
+                error_code ignored;
+                filesystem::rename(rotatedPath, path, ignored);
+                throw runtime_error("Unable to open journal file " + path + ".");
+            }
+            fclose(file);
+            file = fresh;
+            writtenSize = durableSize = ftell(file);
+        #endif
+        lastSync = chrono::steady_clock::now();
+    }
+};
+
+// Source of the current time, replaceable so overdue calculations can be tested deterministically
+using Clock = function<time_t()>;
+
+// OverdueEngine class to keep open loans ordered by their expected return date
+class OverdueEngine {
+private:
+    multimap<time_t, size_t> dueLoans;  // expectedReturnDate -> transaction slot
+    unordered_map<size_t, multimap<time_t, size_t>::iterator> positions;
+
+public:
+    void add(size_t slot, time_t expectedReturnDate) {
+        positions[slot] = dueLoans.emplace(expectedReturnDate, slot);
+    }
+
+    void remove(size_t slot) {
+        auto it = positions.find(slot);
+        if (it != positions.end()) {
+            dueLoans.erase(it->second);
+            positions.erase(it);
+        }
+    }
+
+    void clear() {
+        dueLoans.clear();
+        positions.clear();
+    }
+
+    // Visit the open loans due on or before cutoff, earliest first
+    template <typename Visitor>
+    void forEachDueBy(time_t cutoff, Visitor visit) const {
+        for (auto it = dueLoans.begin(); it != dueLoans.end() && it->first <= cutoff; ++it) {
+            visit(it->second);
+        }
+    }
+};
+
+// DateIndex class to keep (date, slot) entries sorted by date for range scans. Loans arrive in
+// date order almost always, so adding one is an append; an older date is placed by binary search.
+class DateIndex {
+public:
+    using Entry = pair<int64_t, uint32_t>;
+    using const_iterator = vector<Entry>::const_iterator;
+
+    // Entries with from <= date < to, as an iterator range over (date, slot)
+    struct Range {
+        const_iterator first;
+        const_iterator last;
+
+        const_iterator begin() const { return first; }
+        const_iterator end() const { return last; }
+        size_t size() const { return static_cast<size_t>(last - first); }
+    };
+
+private:
+    vector<Entry> entries;
+
+public:
+    void add(int64_t date, uint32_t slot) {
+        if (entries.empty() || entries.back().first <= date) {
+            entries.emplace_back(date, slot);
+        } else {
+            entries.insert(upper_bound(entries.begin(), entries.end(), Entry(date, numeric_limits<uint32_t>::max())),
+                           Entry(date, slot));
+        }
+    }
+
+    // Replace the contents with unsorted entries, sorting them once (equal dates keep slot order)
+    void assign(vector<Entry> unsorted) {
+        entries = move(unsorted);
+        sort(entries.begin(), entries.end());
+    }
+
+    void clear() {
+        entries.clear();
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    Range range(int64_t from, int64_t to) const {
+        auto first = lower_bound(entries.begin(), entries.end(), Entry(from, 0));
+        auto last = lower_bound(first, entries.end(), Entry(to, 0));
+        return Range{first, last};
+    }
+};
+
+// TextScanner class to brute-force substring searches over one contiguous, case-folded text buffer
+class TextScanner {
+private:
+    string text;             // folded records, each followed by a '\0' separator
+    vector<size_t> offsets;  // start of each record in text
+
+    // Find the first position in [from, limit] whose first and last needle bytes match
+    using Kernel = size_t (*)(const char* s, size_t from, size_t limit, char first, char last, size_t length);
+
+    static size_t candidateScalar(const char* s, size_t from, size_t limit, char first, char last, size_t length) {
+        for (size_t i = from; i <= limit; i++) {
+            const void* hit = memchr(s + i, first, limit - i + 1);
+            if (!hit) {
+                break;
+            }
+            i = static_cast<const char*>(hit) - s;
+            if (s[i + length - 1] == last) {
+                return i;
+            }
+        }
+        return string::npos;
+    }
+
+    #ifdef LMS_X86_SIMD
+    __attribute__((target("sse2")))
+    static size_t candidateSse2(const char* s, size_t from, size_t limit, char first, char last, size_t length) {
+        const __m128i firstBytes = _mm_set1_epi8(first);
+        const __m128i lastBytes = _mm_set1_epi8(last);
+        size_t i = from;
+        for (; i + 16 <= limit + 1; i += 16) {
+            __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + length - 1));
+            int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, firstBytes),
+                                                       _mm_cmpeq_epi8(tail, lastBytes)));
+            if (mask) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return candidateScalar(s, i, limit, first, last, length);
+    }
+
+    __attribute__((target("avx2")))
+    static size_t candidateAvx2(const char* s, size_t from, size_t limit, char first, char last, size_t length) {
+        const __m256i firstBytes = _mm256_set1_epi8(first);
+        const __m256i lastBytes = _mm256_set1_epi8(last);
+        size_t i = from;
+        for (; i + 32 <= limit + 1; i += 32) {
+            __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+            __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + length - 1));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(head, firstBytes), _mm256_cmpeq_epi8(tail, lastBytes))));
+            if (mask) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return candidateSse2(s, i, limit, first, last, length);
+    }
+    #endif
+
+    static Kernel selectKernel() {
+        #ifdef LMS_X86_SIMD
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) {
+                return candidateAvx2;
+            }
+            if (__builtin_cpu_supports("sse2")) {
+                return candidateSse2;
+            }
+        #endif
+        return candidateScalar;
+    }
+
+public:
+    // Name of the kernel chosen for this CPU
+    static const char* kernelName() {
+        Kernel kernel = selectKernel();
+        #ifdef LMS_X86_SIMD
+            if (kernel == candidateAvx2) {
+                return "avx2";
+            }
+            if (kernel == candidateSse2) {
+                return "sse2";
+            }
+        #endif
+        return kernel == candidateScalar ? "scalar" : "unknown";
+    }
+
+    void clear() {
+        text.clear();
+        offsets.clear();
+    }
+
+    void reserve(size_t records, size_t bytes) {
+        offsets.reserve(records);
+        text.reserve(bytes);
+    }
+
+    // Append a record; it is case-folded as it is copied in
+    void append(string_view record) {
+        offsets.push_back(text.size());
+        for (char c : record) {
+            text += c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+        text += '\0';
+    }
+
+    size_t size() const { return offsets.size(); }
+
+    // Indices of the records containing a case-folded needle, in record order
+    vector<size_t> find(const string& needle) const {
+        static const Kernel kernel = selectKernel();
+        vector<size_t> matches;
+        size_t length = needle.size();
+        if (length == 0) {
+            for (size_t i = 0; i < offsets.size(); i++) {
+                matches.push_back(i);
+            }
+            return matches;
+        }
+        if (text.size() < length) {
+            return matches;
+        }
+        const char* s = text.data();
+        size_t limit = text.size() - length;
+        size_t i = 0;
+        size_t record = 0;
+        while (i <= limit) {
+            i = kernel(s, i, limit, needle.front(), needle.back(), length);
+            if (i == string::npos) {
+                break;
+            }
+            if (memcmp(s + i, needle.data(), length) != 0) {
+                i++;
+                continue;
+            }
+            // Report the record once and resume at the start of the next one
+            record = upper_bound(offsets.begin() + record, offsets.end(), i) - offsets.begin() - 1;
+            matches.push_back(record);
+            i = record + 1 < offsets.size() ? offsets[record + 1] : text.size();
+        }
+        return matches;
+    }
+};
+
+// SearchIndex class to answer catalog searches from an inverted index over titles, authors and genres
+class SearchIndex {
+public:
+    // A matching book and its relevance score
+    struct Hit {
+        string bookID;
+        int score;
+    };
+
+private:
+    enum Field : uint8_t { TITLE = 1, AUTHOR = 2, GENRE = 4 };
+
+    struct Document {
+        string bookID;
+        string fields[3];  // case-folded title, author and genre
+        bool live = false;
+    };
+
+    vector<Document> documents;
+    vector<uint32_t> freeDocuments;
+    size_t deadDocuments = 0;  // removed documents whose postings have not been purged yet
+    unordered_map<string, uint32_t> documentIDs;                 // bookID -> document
+    map<string, vector<pair<uint32_t, uint8_t>>> postings;       // token -> (document, fields), sorted
+    unordered_map<uint32_t, vector<uint32_t>> trigrams;          // packed trigram -> documents, sorted
+
+    static uint32_t trigramAt(const string& text, size_t i) {
+        return static_cast<uint8_t>(text[i]) | static_cast<uint8_t>(text[i + 1]) << 8 |
+               static_cast<uint32_t>(static_cast<uint8_t>(text[i + 2])) << 16;
+    }
+
+    // Distinct trigrams of a document's folded fields
+    static vector<uint32_t> documentTrigrams(const Document& document) {
+        vector<uint32_t> grams;
+        for (const auto& field : document.fields) {
+            for (size_t i = 0; i + 3 <= field.size(); i++) {
+                grams.push_back(trigramAt(field, i));
+            }
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+    // Distinct tokens of a document with the fields each appears in
+    static map<string, uint8_t> documentTokens(const Document& document) {
+        map<string, uint8_t> tokens;
+        const uint8_t fieldBits[3] = {TITLE, AUTHOR, GENRE};
+        for (int f = 0; f < 3; f++) {
+            for (const auto& token : tokenize(document.fields[f])) {
+                tokens[token] |= fieldBits[f];
+            }
+        }
+        return tokens;
+    }
+
+    static int fieldScore(uint8_t fields) {
+        return (fields & TITLE ? 3 : 0) + (fields & AUTHOR ? 2 : 0) + (fields & GENRE ? 1 : 0);
+    }
+
+public:
+    // Lower-case ASCII letters; other bytes (including UTF-8 sequences) are kept as they are
+    static string fold(string_view text) {
+        string folded(text);
+        for (auto& c : folded) {
+            if (c >= 'A' && c <= 'Z') {
+                c = static_cast<char>(c - 'A' + 'a');
+            }
+        }
+        return folded;
+    }
+
+    // Split folded text into tokens at ASCII punctuation and whitespace
+    static vector<string> tokenize(const string& folded) {
+        vector<string> tokens;
+        string token;
+        for (char c : folded) {
+            if (isalnum(static_cast<unsigned char>(c)) || static_cast<unsigned char>(c) >= 0x80) {
+                token += c;
+            } else if (!token.empty()) {
+                tokens.push_back(token);
+                token.clear();
+            }
+        }
+        if (!token.empty()) {
+            tokens.push_back(token);
+        }
+        return tokens;
+    }
+
+    void clear() {
+        documents.clear();
+        freeDocuments.clear();
+        deadDocuments = 0;
+        documentIDs.clear();
+        postings.clear();
+        trigrams.clear();
+    }
+
+    void add(const Book& book) {
+        if (documentIDs.count(book.getBookID())) {
+            return;  // Only the first book with a given ID is reachable
+        }
+        uint32_t id;
+        if (!freeDocuments.empty()) {
+            id = freeDocuments.back();
+            freeDocuments.pop_back();
+        } else {
+            id = static_cast<uint32_t>(documents.size());
+            documents.emplace_back();
+        }
+        Document& document = documents[id];
+        document.bookID = book.getBookID();
+        document.fields[0] = fold(book.getTitle());
+        document.fields[1] = fold(book.getAuthor());
+        document.fields[2] = fold(book.getGenre());
+        document.live = true;
+        documentIDs.emplace(document.bookID, id);
+
+        for (const auto& token : documentTokens(document)) {
+            auto& list = postings[token.first];
+            auto at = lower_bound(list.begin(), list.end(), make_pair(id, static_cast<uint8_t>(0)));
+            list.insert(at, make_pair(id, token.second));
+        }
+        for (uint32_t gram : documentTrigrams(document)) {
+            auto& list = trigrams[gram];
+            list.insert(lower_bound(list.begin(), list.end(), id), id);
+        }
+    }
+
+    // Remove a book. Its postings stay behind as tombstones that searches skip, because common
+    // tokens and trigrams are shared by most of the catalog and erasing from their lists would make
+    // every delete linear; the tombstones are purged in one pass once a quarter of the documents are dead.
+    void remove(const string& bookID) {
+        auto found = documentIDs.find(bookID);
+        if (found == documentIDs.end()) {
+            return;
+        }
+        documents[found->second].live = false;
+        documentIDs.erase(found);
+        if (++deadDocuments >= 1024 && deadDocuments * 4 >= documents.size()) {
+            purgeDead();
+        }
+    }
+
+    // Drop the postings of removed documents and make their slots reusable
+    void purgeDead() {
+        auto dead = [this](uint32_t id) { return !documents[id].live; };
+        for (auto it = postings.begin(); it != postings.end();) {
+            auto& list = it->second;
+            list.erase(remove_if(list.begin(), list.end(),
+                                 [&dead](const pair<uint32_t, uint8_t>& posting) { return dead(posting.first); }),
+                       list.end());
+            it = list.empty() ? postings.erase(it) : next(it);
+        }
+        for (auto it = trigrams.begin(); it != trigrams.end();) {
+            auto& list = it->second;
+            list.erase(remove_if(list.begin(), list.end(), dead), list.end());
+            it = list.empty() ? trigrams.erase(it) : next(it);
+        }
+        for (uint32_t id = 0; id < documents.size(); id++) {
+            if (!documents[id].live && !documents[id].bookID.empty()) {
+                documents[id] = Document();
+                freeDocuments.push_back(id);
+            }
+        }
+        deadDocuments = 0;
+    }
+
+    // Rank books matching every query term as a token or token prefix, falling back to substring matches
+    vector<Hit> search(const string& query) const {
+        string folded = fold(query);
+        vector<string> terms = tokenize(folded);
+        unordered_map<uint32_t, int> scores;
+        for (size_t t = 0; t < terms.size(); t++) {
+            const string& term = terms[t];
+            unordered_map<uint32_t, int> termScores;
+            for (auto it = postings.lower_bound(term);
+                 it != postings.end() && it->first.compare(0, term.size(), term) == 0; ++it) {
+                int weight = it->first.size() == term.size() ? 2 : 1;  // exact tokens outrank prefixes
+                for (const auto& posting : it->second) {
+                    if (!documents[posting.first].live) {
+                        continue;
+                    }
+                    int& best = termScores[posting.first];
+                    best = max(best, weight * fieldScore(posting.second));
+                }
+            }
+            if (t == 0) {
+                scores = move(termScores);
+                continue;
+            }
+            for (auto it = scores.begin(); it != scores.end();) {
+                auto match = termScores.find(it->first);
+                if (match == termScores.end()) {
+                    it = scores.erase(it);
+                } else {
+                    it->second += match->second;
+                    ++it;
+                }
+            }
+        }
+
+        vector<Hit> hits;
+        if (scores.empty()) {
+            for (uint32_t id : substringCandidates(folded)) {
+                const Document& document = documents[id];
+                for (int f = 0; f < 3; f++) {
+                    if (document.fields[f].find(folded) != string::npos) {
+                        hits.push_back(Hit{document.bookID, 1});
+                        break;
+                    }
+                }
+            }
+            return hits;
+        }
+        hits.reserve(scores.size());
+        for (const auto& score : scores) {
+            hits.push_back(Hit{documents[score.first].bookID, score.second});
+        }
+        return hits;
+    }
+
+    // Books whose folded fields contain every trigram of a folded query of at least three bytes
+    vector<uint32_t> substringCandidates(const string& folded) const {
+        vector<uint32_t> candidates;
+        if (folded.size() < 3) {
+            return candidates;
+        }
+        vector<const vector<uint32_t>*> lists;
+        for (size_t i = 0; i + 3 <= folded.size(); i++) {
+            auto it = trigrams.find(trigramAt(folded, i));
+            if (it == trigrams.end()) {
+                return candidates;
+            }
+            lists.push_back(&it->second);
+        }
+        sort(lists.begin(), lists.end(),
+             [](const vector<uint32_t>* a, const vector<uint32_t>* b) { return a->size() < b->size(); });
+        candidates = *lists[0];
+        for (size_t i = 1; i < lists.size() && !candidates.empty(); i++) {
+            vector<uint32_t> narrowed;
+            set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(), lists[i]->end(),
+                             back_inserter(narrowed));
+            candidates.swap(narrowed);
+        }
+        if (deadDocuments > 0) {
+            candidates.erase(remove_if(candidates.begin(), candidates.end(),
+                                       [this](uint32_t id) { return !documents[id].live; }),
+                             candidates.end());
+        }
+        return candidates;
+    }
+
+    const string& bookIDOf(uint32_t document) const { return documents[document].bookID; }
+};
+
+// RankedCounter class to count loans per key and list the largest counts
+//
+// The ranking is only built the first time top() is asked for and is then kept in step with
+// every add, so partial counters used during a rebuild never pay for it.
+class RankedCounter {
+private:
+    // Largest count first, then by key
+    struct Larger {
+        bool operator()(const pair<uint64_t, string>& a, const pair<uint64_t, string>& b) const {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        }
+    };
+
+    unordered_map<string, uint64_t> counts;
+    set<pair<uint64_t, string>, Larger> ranking;
+    bool ranked = false;
+
+public:
+    void add(const string& key, uint64_t amount = 1) {
+        uint64_t& count = counts[key];
+        if (ranked && count > 0) {
+            ranking.erase(make_pair(count, key));
+        }
+        count += amount;
+        if (ranked) {
+            ranking.emplace(count, key);
+        }
+    }
+
+    void merge(const RankedCounter& other) {
+        for (const auto& entry : other.counts) {
+            add(entry.first, entry.second);
+        }
+    }
+
+    // The n largest counts, largest first (ties by key)
+    vector<pair<string, uint64_t>> top(size_t n) {
+        if (!ranked) {
+            for (const auto& entry : counts) {
+                ranking.emplace(entry.second, entry.first);
+            }
+            ranked = true;
+        }
+        vector<pair<string, uint64_t>> result;
+        for (auto it = ranking.begin(); it != ranking.end() && result.size() < n; ++it) {
+            result.push_back(make_pair(it->second, it->first));
+        }
+        return result;
+    }
+
+    size_t size() const { return counts.size(); }
+    const unordered_map<string, uint64_t>& entries() const { return counts; }
+
+    void clear() {
+        counts.clear();
+        ranking.clear();
+        ranked = false;
+    }
+};
+
+// CirculationStats class to hold running loan aggregates
+//
+// Genre and author are attributed from the catalog when the loan is counted; a rebuild
+// counts loans per book first and attributes each book once.
+class CirculationStats {
+public:
+    RankedCounter byGenre;
+    RankedCounter byAuthor;
+    RankedCounter byBook;    // book ID -> loans
+    RankedCounter byMember;  // member ID -> loans
+    map<long, uint64_t> byMonth;  // month index -> loans
+    uint64_t loans = 0;
+    uint64_t returned = 0;
+    double loanSeconds = 0;  // total duration of returned loans
+    double feesCharged = 0;  // overdue fees of returned loans
+
+    // Count one new loan and attribute it to its book's genre and author
+    void recordBorrow(const Book* book, string_view bookID, string_view memberID, time_t borrowDate) {
+        loans++;
+        byBook.add(string(bookID));
+        byMember.add(string(memberID));
+        byMonth[monthIndex(borrowDate)]++;
+        attribute(book, 1);
+    }
+
+    void attribute(const Book* book, uint64_t count) {
+        byGenre.add(book ? book->getGenre() : "(unknown)", count);
+        byAuthor.add(book ? book->getAuthor() : "(unknown)", count);
+    }
+
+    void recordReturn(time_t borrowDate, time_t returnDate, time_t expectedReturnDate) {
+        returned++;
+        loanSeconds += static_cast<double>(returnDate - borrowDate);
+        feesCharged += Transaction::overdueDays(returnDate, expectedReturnDate, returnDate) * Transaction::DAILY_FEE;
+    }
+
+    void merge(const CirculationStats& other) {
+        byGenre.merge(other.byGenre);
+        byAuthor.merge(other.byAuthor);
+        byBook.merge(other.byBook);
+        byMember.merge(other.byMember);
+        for (const auto& month : other.byMonth) {
+            byMonth[month.first] += month.second;
+        }
+        loans += other.loans;
+        returned += other.returned;
+        loanSeconds += other.loanSeconds;
+        feesCharged += other.feesCharged;
+    }
+
+    void clear() { *this = CirculationStats(); }
+};
+
+// Circulation statistics answered from the running aggregates
+struct CirculationReport {
+    vector<pair<string, uint64_t>> loansByGenre;   // most borrowed first
+    vector<pair<string, uint64_t>> topAuthors;
+    vector<pair<string, uint64_t>> topTitles;      // (title, loans)
+    vector<pair<string, uint64_t>> topMembers;     // (member name, loans)
+    vector<pair<string, uint64_t>> loansByMonth;   // oldest month first
+    uint64_t totalLoans = 0;
+    uint64_t openLoans = 0;
+    double averageLoanDays = 0;  // over returned loans
+    double feesCharged = 0;      // overdue fees of returned loans
+    double feesOutstanding = 0;  // overdue fees accruing on open loans
+};
+
+// Time spent in each phase of the last Library startup
+struct StartupTimings {
+    size_t threads = 1;
+    double loadMs = 0;    // reading the data files
+    double indexMs = 0;   // building the in-memory indexes
+    double replayMs = 0;  // replaying the journal
+};
+
+// Where a paged walk stopped: pass next back as the offset of the following page
+//
+// Offsets are record positions, so a page fetched after a delete may skip or repeat a record.
+struct PageCursor {
+    size_t next = 0;    // position of the first record not yet visited
+    size_t visited = 0; // records handed to the visitor on this page
+    bool more = false;  // whether another matching record follows
+};
+
+// One page of ranked catalog search results
+struct SearchPage {
+    vector<Book> books;
+    vector<int> scores;  // relevance score of each book, for merging pages
+    size_t totalMatches = 0;
+};
+
+// Outcome of a bulk import
+struct ImportReport {
+    size_t rowsRead = 0;
+    size_t imported = 0;
+    size_t duplicates = 0;      // already in the library or repeated earlier in the batch
+    size_t rejected = 0;        // malformed rows
+    vector<string> problems;    // descriptions of the first few rejected rows
+    double seconds = 0;
+};
+
+// Stream CSV records from an input stream in fixed-size chunks, skipping blank lines
+template <typename Visitor>
+void forEachStreamedRecord(istream& in, Visitor visit) {
+    const size_t chunkSize = 1 << 20;
+    string buffer;
+    vector<char> chunk(chunkSize);
+    CsvParser fields;
+    bool eof = false;
+    while (!eof) {
+        in.read(chunk.data(), chunk.size());
+        buffer.append(chunk.data(), static_cast<size_t>(in.gcount()));
+        eof = !in;
+        const char* p = buffer.data();
+        const char* end = p + buffer.size();
+        while (p < end) {
+            const char* next = fields.parse(p, end);
+            if (!fields.complete() && !eof) {
+                break;  // the rest of this record is in the next chunk
+            }
+            if (!fields.empty()) {
+                visit(fields);
+            }
+            p = next;
+        }
+        buffer.erase(0, static_cast<size_t>(p - buffer.data()));
+    }
+}
+
+// Library class to manage books, members, and transactions
+class Library {
+private:
+    vector<Book> books;
+    vector<Member> members;
+    TransactionStore transactions;
+
+    // ID -> slot indexes into books and members
+    unordered_map<string, size_t> bookIndex;
+    unordered_map<string, size_t> memberIndex;
+
+    // Open loans: bookID -> transaction slot, and memberID -> transaction slots
+    unordered_map<string, size_t> activeLoanByBook;
+    unordered_map<string, unordered_set<size_t>> activeLoansByMember;
+    OverdueEngine overdueEngine;
+
+    // In-memory loans sorted by borrow date, by expected return date, and per member by borrow date
+    DateIndex loansByBorrowDate;
+    DateIndex loansByDueDate;
+    vector<DateIndex> loansByMember;  // indexed by the member ID's handle in transactions
+    unsigned long long nextTransactionNumber = 1;  // one past the highest numeric transaction ID seen
+
+    // Closed loans from before the hot window, one CSV partition per borrow month under archive/
+    set<string> archiveMonths;                             // months with a partition on disk
+    mutable map<string, TransactionStore> archivedLoans;   // partitions loaded so far
+    mutable mutex archiveMutex;                            // guards lazy partition loads from concurrent readers
+    unsigned long long archivedNextTransaction = 1;        // ID counter saved with the archive
+    set<string> movingMonths;  // months whose partitions may repeat loans still in the saved hot file
+    atomic<bool> archiveSettled{false};  // a background write saved the hot file after the last archive pass
+
+    // Circulation aggregates, rebuilt from the full history on the first report and then
+    // updated on every borrow and return
+    mutable CirculationStats analytics;
+    mutable bool analyticsStale = true;
+    mutable mutex analyticsMutex;  // guards the lazy rebuild when readers run concurrently
+
+    // Multi-version reads: each committed mutation advances version. While snapshots are open, a
+    // change that overwrites what one of them can see keeps the old value, stamped with the version
+    // that replaced it; closing the oldest snapshot drops the values no open snapshot still needs.
+    // An archive pass moves loan slots, so it expires every open snapshot (see archiveClosedLoans).
+    uint64_t version = 0;
+    uint64_t snapshotEpoch = 0;                                       // archive passes that expired snapshots
+    multimap<uint64_t, chrono::steady_clock::time_point> openSnapshots;  // version -> when opened
+    unordered_map<size_t, uint64_t> returnVersions;                    // loan slot -> version that closed it
+    unordered_map<string, vector<pair<uint64_t, Book>>> bookVersions;  // ID -> (replaced at, earlier copy)
+    unordered_map<string, vector<pair<uint64_t, Member>>> memberVersions;
+
+    StartupTimings startup;
+    SearchIndex searchIndex;
+
+    // Contiguous folded copies of member names and book titles for substring scans,
+    // rebuilt on the next search after an edit or delete
+    mutable TextScanner memberNames;
+    mutable TextScanner bookTitles;
+    mutable bool memberNamesStale = true;
+    mutable bool bookTitlesStale = true;
+    mutable mutex scannerMutex;  // guards the lazy scanner rebuild when readers run concurrently
+
+    // Readers share stateMutex and writers hold it exclusively (only in thread-safe mode)
+    mutable shared_mutex stateMutex;
+
+    shared_lock<shared_mutex> readLock() const {
+        return options.threadSafe ? shared_lock<shared_mutex>(stateMutex) : shared_lock<shared_mutex>();
+    }
+
+    unique_lock<shared_mutex> writeLock() {
+        return options.threadSafe ? unique_lock<shared_mutex>(stateMutex) : unique_lock<shared_mutex>();
+    }
+    Clock clock = [] { return time(nullptr); };
+
+    // Members are reported as overdue once a loan is more than this many days late
+    static const int OVERDUE_REPORT_DAYS = 14;
+
+    LibraryOptions options;
+    unique_ptr<Journal> journal;
+    unsigned long long lastLsn = 0;         // sequence number of the last journal record
+    size_t recordsSinceCheckpoint = 0;
+    int dirtyFiles = 0;                     // data files changed since they were last handed to a writer
+
+    // Background writer: one snapshot at a time, working from its own copy of the dirty containers
+    thread snapshotThread;
+    atomic<bool> snapshotRunning{false};
+    atomic<int> failedFiles{0};  // files whose background write failed; the next write retries them
+
+    static constexpr const char* JOURNAL_FILE = "journal.log";
+    static constexpr const char* CHECKPOINT_FILE = "checkpoint.txt";
+    static constexpr const char* BINARY_FILE = "library.bin";
+    static constexpr const char* ARCHIVE_DIR = "archive";
+    static constexpr const char* ARCHIVE_MANIFEST = "manifest.txt";
+
+    // Data files touched by a mutation (used to skip rewriting unchanged files)
+    enum DataFile { BOOKS_FILE = 1, MEMBERS_FILE = 2, TRANSACTIONS_FILE = 4, ALL_FILES = 7 };
+
+    // Copy of the dirty state handed to the background writer
+    struct SnapshotJob {
+        int dataFiles = 0;
+        vector<Book> books;
+        vector<Member> members;
+        TransactionStore transactions;
+        bool checkpoint = false;  // journal mode: advance checkpoint.txt to lsn afterwards
+        unsigned long long lsn = 0;
+        bool settleArchive = false;  // clear the moving months from the archive manifest afterwards
+        unsigned long long archivedNext = 0;
+    };
+
+    // Map a data file and visit each non-empty record, reserving room for one record per line
+    template <typename Records, typename Visitor>
+    static void forEachRecord(const string& path, Records& records, Visitor visit) {
+        if (!filesystem::exists(path)) {
+            return;
+        }
+        MappedFile file(path);
+        forEachRecordIn(file.data(), file.data() + file.size(), records, visit);
+    }
+
+    // Visit each non-empty record in [p, end), which must start at a record boundary
+    template <typename Records, typename Visitor>
+    static void forEachRecordIn(const char* p, const char* end, Records& records, Visitor visit) {
+        records.reserve(records.size() + count(p, end, '\n') + 1);
+        CsvParser fields;
+        while (p < end) {
+            p = fields.parse(p, end);
+            if (!fields.empty()) {
+                visit(fields);
+            }
+        }
+    }
+
+    static Book bookFromRecord(const CsvParser& f) {
+        Book book(f.str(0), f.str(1), f.str(2), f.str(3));
+        book.setAvailability(f[4] == "Available");
+        return book;
+    }
+
+    static Member memberFromRecord(const CsvParser& f) {
+        return Member(f.str(0), f.str(1), f.str(2), f.str(3));
+    }
+
+    // Load books from file
+    void loadBooks() {
+        forEachRecord(dataPath(options.dataDir, "books.txt"), books,
+                      [this](const CsvParser& f) { books.push_back(bookFromRecord(f)); });
+    }
+
+    // Load members from file
+    void loadMembers() {
+        forEachRecord(dataPath(options.dataDir, "members.txt"), members,
+                      [this](const CsvParser& f) { members.push_back(memberFromRecord(f)); });
+    }
+
+    // Load transactions from file
+    void loadTransactions() {
+        forEachRecord(dataPath(options.dataDir, "transactions.txt"), transactions, [this](const CsvParser& f) {
+            transactions.append(f[0], f[1], f[2], f.integer(3), f.integer(4), f.integer(5));
+        });
+    }
+
+    // Parse the three text files at once, each split into chunks at record boundaries, then
+    // join the chunks in file order
+    void loadTextFiles(size_t threadCount) {
+        LMS_TIME(LoadData);
+        if (threadCount <= 1) {
+            loadBooks();
+            loadMembers();
+            loadTransactions();
+            return;
+        }
+        unique_ptr<MappedFile> files[3];
+        const char* names[3] = {"books.txt", "members.txt", "transactions.txt"};
+        size_t totalBytes = 0;
+        for (int i = 0; i < 3; i++) {
+            string path = dataPath(options.dataDir, names[i]);
+            if (filesystem::exists(path)) {
+                files[i].reset(new MappedFile(path));
+                totalBytes += files[i]->size();
+            }
+        }
+        // Aim for a few chunks per thread so the three files balance out, but not tiny ones
+        size_t chunkBytes = max<size_t>(1 << 20, totalBytes / (threadCount * 4) + 1);
+        vector<const char*> bounds[3];
+        for (int i = 0; i < 3; i++) {
+            if (files[i]) {
+                const char* begin = files[i]->data();
+                bounds[i] = splitRecords(begin, begin + files[i]->size(), files[i]->size() / chunkBytes + 1);
+            }
+        }
+
+        size_t bookChunks = bounds[0].empty() ? 0 : bounds[0].size() - 1;
+        size_t memberChunks = bounds[1].empty() ? 0 : bounds[1].size() - 1;
+        size_t transactionChunks = bounds[2].empty() ? 0 : bounds[2].size() - 1;
+        vector<vector<Book>> bookParts(bookChunks);
+        vector<vector<Member>> memberParts(memberChunks);
+        vector<TransactionStore> transactionParts(transactionChunks);
+        vector<function<void()>> tasks;
+        // Largest file first so its chunks start early
+        for (size_t c = 0; c < transactionChunks; c++) {
+            tasks.push_back([&, c] {
+                TransactionStore& part = transactionParts[c];
+                forEachRecordIn(bounds[2][c], bounds[2][c + 1], part, [&part](const CsvParser& f) {
+                    part.append(f[0], f[1], f[2], f.integer(3), f.integer(4), f.integer(5));
+                });
+            });
+        }
+        for (size_t c = 0; c < bookChunks; c++) {
+            tasks.push_back([&, c] {
+                forEachRecordIn(bounds[0][c], bounds[0][c + 1], bookParts[c],
+                                [&](const CsvParser& f) { bookParts[c].push_back(bookFromRecord(f)); });
+            });
+        }
+        for (size_t c = 0; c < memberChunks; c++) {
+            tasks.push_back([&, c] {
+                forEachRecordIn(bounds[1][c], bounds[1][c + 1], memberParts[c],
+                                [&](const CsvParser& f) { memberParts[c].push_back(memberFromRecord(f)); });
+            });
+        }
+        runParallel(threadCount, move(tasks));
+
+        for (auto& part : bookParts) {
+            books.insert(books.end(), make_move_iterator(part.begin()), make_move_iterator(part.end()));
+        }
+        for (auto& part : memberParts) {
+            members.insert(members.end(), make_move_iterator(part.begin()), make_move_iterator(part.end()));
+        }
+        for (size_t c = 0; c < transactionParts.size(); c++) {
+            if (c == 0) {
+                transactions = move(transactionParts[0]);
+            } else {
+                transactions.appendAll(transactionParts[c]);
+            }
+        }
+    }
+
+    // Load every record from the memory-mapped binary catalog
+    void loadBinary() {
+        LMS_TIME(LoadData);
+        string path = dataPath(options.dataDir, BINARY_FILE);
+        if (!ifstream(path)) {
+            return;
+        }
+        BinaryCatalogView view(path);
+        books.reserve(view.bookCount());
+        for (size_t i = 0; i < view.bookCount(); i++) {
+            Book book(string(view.bookID(i)), string(view.bookTitle(i)), string(view.bookAuthor(i)),
+                      string(view.bookGenre(i)));
+            book.setAvailability(view.bookIsAvailable(i));
+            books.push_back(book);
+        }
+        members.reserve(view.memberCount());
+        for (size_t i = 0; i < view.memberCount(); i++) {
+            members.push_back(Member(string(view.memberID(i)), string(view.memberName(i)),
+                                     string(view.memberAddress(i)), string(view.memberPhone(i))));
+        }
+        transactions.reserve(view.transactionCount());
+        for (size_t i = 0; i < view.transactionCount(); i++) {
+            transactions.append(view.transactionID(i), view.transactionMemberID(i), view.transactionBookID(i),
+                                view.borrowDate(i), view.returnDate(i), view.expectedReturnDate(i));
+        }
+    }
+
+    // Write the given data files to dir in the given format. Every file is staged and synced
+    // before any is renamed into place, which keeps the window where the files disagree short.
+    static void writeDataFiles(int dataFiles, const string& dir, DataFormat format, const vector<Book>& books,
+                               const vector<Member>& members, const TransactionStore& transactions) {
+        for (const auto& path : stageDataFiles(dataFiles, dir, format, books, members, transactions)) {
+            publishFile(path);
+        }
+    }
+
+    // Stage the given data files in dir as path.tmp, synced, and return the paths to publish
+    static vector<string> stageDataFiles(int dataFiles, const string& dir, DataFormat format,
+                                         const vector<Book>& books, const vector<Member>& members,
+                                         const TransactionStore& transactions) {
+        LMS_TIME(SaveData);
+        if (format == DataFormat::Binary) {
+            BinaryCatalogWriter writer;
+            for (const auto& book : books) {
+                writer.addBook(book);
+            }
+            for (const auto& member : members) {
+                writer.addMember(member);
+            }
+            for (size_t i = 0; i < transactions.size(); i++) {
+                writer.addTransaction(transactions[i]);
+            }
+            writer.stage(dataPath(dir, BINARY_FILE));
+            LMS_COUNT(RecordsWritten, books.size() + members.size() + transactions.size());
+            return {dataPath(dir, BINARY_FILE)};
+        }
+        vector<string> staged;
+        if (dataFiles & BOOKS_FILE) {
+            staged.push_back(dataPath(dir, "books.txt"));
+            stageFile(staged.back(), [&books](ofstream& file) {
+                for (const auto& book : books) {
+                    file << book.toString() << '\n';
+                }
+            });
+        }
+        if (dataFiles & MEMBERS_FILE) {
+            staged.push_back(dataPath(dir, "members.txt"));
+            stageFile(staged.back(), [&members](ofstream& file) {
+                for (const auto& member : members) {
+                    file << member.toString() << '\n';
+                }
+            });
+        }
+        if (dataFiles & TRANSACTIONS_FILE) {
+            staged.push_back(dataPath(dir, "transactions.txt"));
+            stageFile(staged.back(), [&transactions](ofstream& file) {
+                for (size_t i = 0; i < transactions.size(); i++) {
+                    file << transactions[i].toString() << '\n';
+                }
+            });
+        }
+        LMS_COUNT(RecordsWritten, (dataFiles & BOOKS_FILE ? books.size() : 0) +
+                                      (dataFiles & MEMBERS_FILE ? members.size() : 0) +
+                                      (dataFiles & TRANSACTIONS_FILE ? transactions.size() : 0));
+        return staged;
+    }
+
+    void saveData(int dataFiles, const string& dir, DataFormat format) const {
+        writeDataFiles(dataFiles, dir, format, books, members, transactions);
+    }
+
+    // Rebuild the ID -> slot indexes from scratch (the first record wins on duplicate IDs).
+    // The book, member and loan indexes touch disjoint state, so they can be built concurrently.
+    void rebuildIndexes(size_t threadCount = 1) {
+        LMS_TIME(BuildIndexes);
+        bookTitlesStale = true;
+        memberNamesStale = true;
+        vector<function<void()>> tasks;
+        tasks.push_back([this] {
+            bookIndex.clear();
+            bookIndex.reserve(books.size());
+            searchIndex.clear();
+            for (size_t i = 0; i < books.size(); i++) {
+                bookIndex.emplace(books[i].getBookID(), i);
+                searchIndex.add(books[i]);
+            }
+        });
+        tasks.push_back([this] {
+            memberIndex.clear();
+            memberIndex.reserve(members.size());
+            for (size_t i = 0; i < members.size(); i++) {
+                memberIndex.emplace(members[i].getMemberID(), i);
+            }
+        });
+        tasks.push_back([this] {
+            nextTransactionNumber = archivedNextTransaction;
+            for (size_t i = 0; i < transactions.size(); i++) {
+                noteTransactionID(transactions.transactionID(i));
+            }
+            rebuildLoanIndexes();
+        });
+        runParallel(threadCount, move(tasks));
+    }
+
+    // Rebuild the open-loan indexes after transaction slots have moved
+    void rebuildLoanIndexes() {
+        activeLoanByBook.clear();
+        activeLoansByMember.clear();
+        overdueEngine.clear();
+        vector<DateIndex::Entry> borrowed;
+        vector<DateIndex::Entry> due;
+        vector<vector<DateIndex::Entry>> byMember(transactions.handleCount());
+        borrowed.reserve(transactions.size());
+        due.reserve(transactions.size());
+        for (size_t i = 0; i < transactions.size(); i++) {
+            if (transactions.returnDate(i) == 0) {
+                openLoan(i);
+            }
+            uint32_t slot = static_cast<uint32_t>(i);
+            borrowed.emplace_back(transactions.borrowDate(i), slot);
+            due.emplace_back(transactions.expectedReturnDate(i), slot);
+            byMember[transactions.memberHandle(i)].emplace_back(transactions.borrowDate(i), slot);
+        }
+        loansByBorrowDate.assign(move(borrowed));
+        loansByDueDate.assign(move(due));
+        loansByMember.assign(byMember.size(), DateIndex());
+        for (size_t handle = 0; handle < byMember.size(); handle++) {
+            if (!byMember[handle].empty()) {
+                loansByMember[handle].assign(move(byMember[handle]));
+            }
+        }
+    }
+
+    // Add a newly recorded loan to the date indexes
+    void indexLoanDates(size_t slot) {
+        uint32_t handle = transactions.memberHandle(slot);
+        if (handle >= loansByMember.size()) {
+            loansByMember.resize(transactions.handleCount());
+        }
+        loansByBorrowDate.add(transactions.borrowDate(slot), static_cast<uint32_t>(slot));
+        loansByDueDate.add(transactions.expectedReturnDate(slot), static_cast<uint32_t>(slot));
+        loansByMember[handle].add(transactions.borrowDate(slot), static_cast<uint32_t>(slot));
+    }
+
+    // Visit up to limit of the loans in an index range, skipping the first offset
+    template <typename Visitor>
+    PageCursor walkDateRange(const DateIndex::Range& range, size_t offset, size_t limit, Visitor visit) const {
+        PageCursor cursor;
+        cursor.next = min(offset, range.size());
+        for (auto it = range.begin() + cursor.next; it != range.end(); ++it) {
+            if (cursor.visited == limit) {
+                cursor.more = true;
+                return cursor;
+            }
+            visit(TransactionRef(transactions, it->second));
+            cursor.visited++;
+            cursor.next++;
+        }
+        return cursor;
+    }
+
+    // A member's loans in the hot store borrowed in [from, to), through the member index
+    DateIndex::Range memberLoanRange(const string& memberID, time_t from, time_t to) const {
+        uint32_t handle = transactions.findHandle(memberID);
+        if (handle >= loansByMember.size()) {
+            static const DateIndex none;
+            return none.range(from, to);
+        }
+        return loansByMember[handle].range(from, to);
+    }
+
+    void noteTransactionID(const string& transactionID) {
+        unsigned long long number = 0;
+        auto result = from_chars(transactionID.data(), transactionID.data() + transactionID.size(), number);
+        if (result.ec == errc() && number >= nextTransactionNumber) {
+            nextTransactionNumber = number + 1;
+        }
+    }
+
+    void openLoan(size_t slot) {
+        activeLoanByBook[string(transactions.bookID(slot))] = slot;
+        activeLoansByMember[string(transactions.memberID(slot))].insert(slot);
+        overdueEngine.add(slot, transactions.expectedReturnDate(slot));
+    }
+
+    void closeLoan(size_t slot) {
+        activeLoanByBook.erase(string(transactions.bookID(slot)));
+        overdueEngine.remove(slot);
+        auto it = activeLoansByMember.find(string(transactions.memberID(slot)));
+        if (it != activeLoansByMember.end()) {
+            it->second.erase(slot);
+            if (it->second.empty()) {
+                activeLoansByMember.erase(it);
+            }
+        }
+    }
+
+    // Erase the record at slot by moving the last record into its place, so a delete costs the same
+    // whatever the catalog size; only the moved record's index entry changes
+    template <typename T, typename GetID>
+    static void eraseIndexed(vector<T>& records, unordered_map<string, size_t>& index, size_t slot, GetID getID) {
+        bool repeatedIDs = index.size() < records.size();  // some ID appears twice in the data files
+        string id = getID(records[slot]);
+        index.erase(id);
+        size_t last = records.size() - 1;
+        if (slot != last) {
+            auto moved = index.find(getID(records[last]));
+            if (moved != index.end() && moved->second == last) {
+                moved->second = slot;
+            }
+            records[slot] = move(records[last]);
+        }
+        records.pop_back();
+        if (repeatedIDs) {
+            // Another record may carry the erased ID; it takes over the index entry
+            for (size_t i = 0; i < records.size(); i++) {
+                if (getID(records[i]) == id) {
+                    index.emplace(id, i);
+                    break;
+                }
+            }
+        }
+    }
+
+    // Replace the record at slot, moving its index entry if the ID changed
+    template <typename T, typename GetID>
+    static void replaceIndexed(vector<T>& records, unordered_map<string, size_t>& index, size_t slot,
+                               const T& updated, GetID getID, const char* duplicateMessage) {
+        string oldID = getID(records[slot]);
+        string newID = getID(updated);
+        if (newID != oldID) {
+            if (index.count(newID)) {
+                throw runtime_error(duplicateMessage);
+            }
+            index.erase(oldID);
+            index.emplace(newID, slot);
+        }
+        records[slot] = updated;
+    }
+
+    // Throw unless the record to edit exists and the ID it is being given is free
+    static void checkReplace(const unordered_map<string, size_t>& index, const string& id, const string& newID,
+                             const char* notFound, const char* duplicateMessage) {
+        if (!index.count(id)) {
+            throw runtime_error(notFound);
+        }
+        if (newID != id && index.count(newID)) {
+            throw runtime_error(duplicateMessage);
+        }
+    }
+
+    // Finish publishing the data files of a checkpoint that was committed but interrupted before
+    // all of them were renamed into place (see finishCheckpoint)
+    void recoverCheckpoint() {
+        string path = dataPath(options.dataDir, CHECKPOINT_FILE);
+        ifstream checkpoint(path);
+        unsigned long long lsn = 0;
+        string line;
+        if (!getline(checkpoint, line)) {
+            return;
+        }
+        stringstream(line) >> lsn;
+        bool pending = false;
+        while (getline(checkpoint, line)) {
+            CsvParser fields;
+            fields.parse(line.data(), line.data() + line.size());
+            if (fields.size() == 2 && fields[0] == "pending") {
+                pending = true;
+                string data = dataPath(options.dataDir, fields.str(1));
+                if (filesystem::exists(data + ".tmp")) {
+                    publishFile(data);
+                }
+            }
+        }
+        checkpoint.close();
+        if (pending) {
+            writeFileAtomically(path, [lsn](ofstream& file) { file << lsn << '\n'; });
+        }
+    }
+
+    // Sequence number of the last journal record folded into the data files
+    unsigned long long readCheckpointLsn() const {
+        unsigned long long lsn = 0;
+        ifstream checkpoint(dataPath(options.dataDir, CHECKPOINT_FILE));
+        checkpoint >> lsn;
+        return lsn;
+    }
+
+    // Rotated journal files (journal.log.<last lsn>) waiting for a checkpoint, oldest first
+    vector<pair<unsigned long long, string>> rotatedJournals() const {
+        vector<pair<unsigned long long, string>> rotated;
+        string prefix = string(JOURNAL_FILE) + ".";
+        for (const auto& entry : filesystem::directory_iterator(options.dataDir.empty() ? "." : options.dataDir)) {
+            string name = entry.path().filename().string();
+            unsigned long long lsn = 0;
+            const char* end = name.data() + name.size();
+            if (name.compare(0, prefix.size(), prefix) == 0 &&
+                from_chars(name.data() + prefix.size(), end, lsn).ptr == end && name.size() > prefix.size()) {
+                rotated.emplace_back(lsn, entry.path().string());
+            }
+        }
+        sort(rotated.begin(), rotated.end());
+        return rotated;
+    }
+
+    // Replay journal records written after the last checkpoint: the rotated logs a background
+    // checkpoint has not yet retired, then the live log
+    void replayJournal() {
+        LMS_TIME(ReplayJournal);
+        unsigned long long checkpointLsn = readCheckpointLsn();
+        lastLsn = checkpointLsn;
+
+        vector<string> paths;
+        for (const auto& rotated : rotatedJournals()) {
+            if (rotated.first > checkpointLsn) {
+                paths.push_back(rotated.second);
+            }
+        }
+        paths.push_back(dataPath(options.dataDir, JOURNAL_FILE));
+        for (const auto& path : paths) {
+            if (!replayJournalFile(path, checkpointLsn)) {
+                break;
+            }
+        }
+        if (recordsSinceCheckpoint > 0) {
+            dirtyFiles = ALL_FILES;
+        }
+    }
+
+    // Apply the records of one journal file; false if it ended in a torn record
+    bool replayJournalFile(const string& path, unsigned long long checkpointLsn) {
+        if (!filesystem::exists(path)) {
+            return true;
+        }
+        MappedFile file(path);
+        const char* p = file.data();
+        const char* end = p + file.size();
+        CsvParser parser;
+        while (p < end) {
+            p = parser.parse(p, end);
+            vector<string> fields;
+            for (size_t i = 0; i < parser.size(); i++) {
+                fields.push_back(parser.str(i));
+            }
+            unsigned long long lsn;
+            try {
+                if (!parser.complete() || fields.size() < 2) {
+                    return false;
+                }
+                lsn = stoull(fields[0]);
+                if (lsn <= checkpointLsn) {
+                    continue;
+                }
+                applyRecord(fields);
+            } catch (const logic_error&) {
+                return false;  // A torn record (a cut-off number or field) marks the end of the durable log
+            } catch (const exception& e) {
+                // A complete record that cannot be applied means the data files and the journal
+                // disagree; stopping here would silently drop every later record
+                throw runtime_error("Journal record " + fields[0] + " in " + path + " cannot be replayed: " +
+                                    e.what());
+            }
+            lastLsn = lsn;
+            recordsSinceCheckpoint++;
+        }
+        return true;
+    }
+
+    // Apply one journal record (lsn, op, payload...) to the in-memory state
+    void applyRecord(const vector<string>& f) {
+        const string& op = f.at(1);
+        if (op == "AB" || op == "EB") {
+            size_t first = op == "AB" ? 2 : 3;
+            Book book(f.at(first), f.at(first + 1), f.at(first + 2), f.at(first + 3));
+            book.setAvailability(f.at(first + 4) == "Available");
+            if (op == "AB") {
+                applyAddBook(book);
+            } else {
+                applyEditBook(f.at(2), book);
+            }
+        } else if (op == "DB") {
+            applyDeleteBook(f.at(2));
+        } else if (op == "AM" || op == "EM") {
+            size_t first = op == "AM" ? 2 : 3;
+            Member member(f.at(first), f.at(first + 1), f.at(first + 2), f.at(first + 3));
+            if (op == "AM") {
+                applyAddMember(member);
+            } else {
+                applyEditMember(f.at(2), member);
+            }
+        } else if (op == "DM") {
+            applyDeleteMember(f.at(2));
+        } else if (op == "BR") {
+            applyBorrow(Transaction(f.at(2), f.at(3), f.at(4), stoll(f.at(5)), stoll(f.at(6)), stoll(f.at(7))));
+        } else if (op == "RT") {
+            applyReturn(f.at(2), stoll(f.at(3)));
+        } else if (op == "BB") {
+            if (f.size() < 2 || (f.size() - 2) % 6 != 0) {
+                throw runtime_error("Malformed batch borrow record.");
+            }
+            for (size_t i = 2; i < f.size(); i += 6) {
+                applyBorrow(Transaction(f[i], f[i + 1], f[i + 2], stoll(f[i + 3]), stoll(f[i + 4]), stoll(f[i + 5])));
+            }
+        } else if (op == "RB") {
+            time_t returnDate = stoll(f.at(2));
+            for (size_t i = 3; i < f.size(); i++) {
+                applyReturn(f[i], returnDate);
+            }
+        } else if (op == "AR") {
+            applyArchivePass(set<string>(f.begin() + 2, f.end()));
+        } else {
+            throw runtime_error("Unknown journal record.");
+        }
+    }
+
+    // Make a validated mutation durable, then apply it: in journal mode the record is written ahead
+    // of the change, so a journal write that fails leaves memory untouched; otherwise the affected
+    // data files are scheduled for rewriting. apply must not throw.
+    template <typename Apply>
+    void commit(const string& record, int dataFiles, Apply apply) {
+        if (options.persistence == PersistenceMode::Journal) {
+            journal->append(to_string(lastLsn + 1) + "," + record);
+            lastLsn++;
+        }
+        apply();
+        version++;
+        dirtyFiles |= dataFiles;
+        if (options.persistence == PersistenceMode::Journal) {
+            if (++recordsSinceCheckpoint >= options.compactionThreshold) {
+                startSnapshot();
+            }
+        } else if (options.persistence == PersistenceMode::Snapshot) {
+            startSnapshot();
+        }
+    }
+
+    // Dirty files to write next, including any whose last background write failed
+    int takeDirtyFiles() {
+        int files = dirtyFiles | failedFiles.exchange(0);
+        dirtyFiles = 0;
+        return files && options.format == DataFormat::Binary ? ALL_FILES : files;
+    }
+
+    // Write the dirty data files on the calling thread; when checkpointing, together with a
+    // checkpoint at the last journal record
+    void flushDirtyFiles(bool checkpointing = false) {
+        int files = takeDirtyFiles();
+        try {
+            if (checkpointing) {
+                finishCheckpoint(lastLsn,
+                                 stageDataFiles(files, options.dataDir, options.format, books, members, transactions));
+            } else {
+                saveData(files, options.dataDir, options.format);
+            }
+        } catch (...) {
+            dirtyFiles |= files;
+            throw;
+        }
+        if ((files & TRANSACTIONS_FILE) && !movingMonths.empty()) {
+            movingMonths.clear();
+            writeArchiveManifest(archivedNextTransaction, movingMonths);
+        }
+    }
+
+    void waitForSnapshot() {
+        if (snapshotThread.joinable()) {
+            snapshotThread.join();
+        }
+        if (archiveSettled.exchange(false)) {
+            movingMonths.clear();
+        }
+    }
+
+    // Copy the dirty containers and write them on the background thread, so the caller never waits
+    // for the disk. In journal mode the log is rotated at the same point, and the background job
+    // checkpoints up to the last rotated record. While a write is still running this does nothing;
+    // the changes stay dirty and go out with the next one.
+    void startSnapshot() {
+        if (snapshotRunning) {
+            return;
+        }
+        waitForSnapshot();
+        bool checkpointing = options.persistence == PersistenceMode::Journal;
+        if (checkpointing) {
+            archiveClosedLoans();
+        }
+        auto job = make_shared<SnapshotJob>();
+        job->dataFiles = takeDirtyFiles();
+        if (job->dataFiles == 0 && !checkpointing) {
+            return;
+        }
+        try {
+            if (job->dataFiles & BOOKS_FILE) {
+                job->books = books;
+            }
+            if (job->dataFiles & MEMBERS_FILE) {
+                job->members = members;
+            }
+            if (job->dataFiles & TRANSACTIONS_FILE) {
+                job->transactions = transactions;
+                job->settleArchive = !movingMonths.empty();
+                job->archivedNext = archivedNextTransaction;
+            }
+            if (checkpointing) {
+                // An existing file of that name means no record was appended since the last rotation
+                string rotated = dataPath(options.dataDir, string(JOURNAL_FILE) + "." + to_string(lastLsn));
+                if (!filesystem::exists(rotated)) {
+                    try {
+                        journal->rotate(dataPath(options.dataDir, JOURNAL_FILE), rotated);
+                    } catch (const exception& e) {
+                        // The log carries on in the current file; try again after as many records
+                        cerr << "Warning: checkpoint postponed: " << e.what() << endl;
+                        dirtyFiles |= job->dataFiles;
+                        recordsSinceCheckpoint = 0;
+                        return;
+                    }
+                }
+                job->checkpoint = true;
+                job->lsn = lastLsn;
+                recordsSinceCheckpoint = 0;
+            }
+        } catch (...) {
+            dirtyFiles |= job->dataFiles;
+            throw;
+        }
+        snapshotRunning = true;
+        snapshotThread = thread([this, job] { runSnapshot(*job); });
+    }
+
+    // Background half of startSnapshot
+    void runSnapshot(const SnapshotJob& job) {
+        try {
+            if (job.checkpoint) {
+                finishCheckpoint(job.lsn, stageDataFiles(job.dataFiles, options.dataDir, options.format, job.books,
+                                                         job.members, job.transactions));
+            } else {
+                writeDataFiles(job.dataFiles, options.dataDir, options.format, job.books, job.members,
+                               job.transactions);
+            }
+            if (job.settleArchive) {
+                writeArchiveManifest(job.archivedNext, {});
+                archiveSettled = true;
+            }
+        } catch (const exception& e) {
+            failedFiles |= job.dataFiles;
+            cerr << "Error: background snapshot failed: " << e.what() << endl;
+        }
+        snapshotRunning = false;
+    }
+
+    // Publish the staged data files and record that they hold every journal record up to lsn, then
+    // retire the rotated logs. Writing checkpoint.txt is the commit point: it names the staged files
+    // along with lsn, so a crash while they are renamed into place is finished by recoverCheckpoint
+    // rather than leaving new data files under an old sequence number, whose records would then be
+    // replayed a second time.
+    void finishCheckpoint(unsigned long long lsn, const vector<string>& staged = {}) const {
+        string path = dataPath(options.dataDir, CHECKPOINT_FILE);
+        writeFileAtomically(path, [lsn, &staged](ofstream& file) {
+            file << lsn << '\n';
+            for (const auto& data : staged) {
+                file << "pending," << filesystem::path(data).filename().string() << '\n';
+            }
+        });
+        for (const auto& data : staged) {
+            publishFile(data);
+        }
+        if (!staged.empty()) {
+            writeFileAtomically(path, [lsn](ofstream& file) { file << lsn << '\n'; });
+        }
+        for (const auto& rotated : rotatedJournals()) {
+            if (rotated.first <= lsn) {
+                filesystem::remove(rotated.second);
+            }
+        }
+    }
+
+    // Fold the journal into the data files and start a fresh log, on the calling thread
+    void checkpoint() {
+        LMS_TIME(Checkpoint);
+        waitForSnapshot();
+        archiveClosedLoans();
+        flushDirtyFiles(true);
+        // Rotate rather than truncate, so a replica still reading the old log keeps its records
+        string rotated = dataPath(options.dataDir, string(JOURNAL_FILE) + "." + to_string(lastLsn));
+        if (!filesystem::exists(rotated)) {
+            journal->rotate(dataPath(options.dataDir, JOURNAL_FILE), rotated);
+        }
+        filesystem::remove(rotated);
+        recordsSinceCheckpoint = 0;
+    }
+
+    string archivePath(const string& name) const {
+        return dataPath(dataPath(options.dataDir, ARCHIVE_DIR), name);
+    }
+
+    static string partitionFile(const string& month) {
+        return "transactions-" + month + ".txt";
+    }
+
+    // Find the archived months on disk and the saved transaction ID counter
+    void loadArchive() {
+        string dir = archivePath("");
+        if (!filesystem::is_directory(dir)) {
+            return;
+        }
+        for (const auto& entry : filesystem::directory_iterator(dir)) {
+            string name = entry.path().filename().string();
+            if (name.size() == partitionFile("YYYY-MM").size() && name.compare(0, 13, "transactions-") == 0) {
+                archiveMonths.insert(name.substr(13, 7));
+            }
+        }
+        ifstream manifest(archivePath(ARCHIVE_MANIFEST));
+        string line;
+        while (getline(manifest, line)) {
+            CsvParser fields;
+            fields.parse(line.data(), line.data() + line.size());
+            if (fields.size() == 2 && fields[0] == "next") {
+                archivedNextTransaction = max<unsigned long long>(archivedNextTransaction, fields.integer(1));
+            } else if (fields.size() == 2 && fields[0] == "moving") {
+                movingMonths.insert(fields.str(1));
+            }
+        }
+    }
+
+    // Save the transaction ID counter and the months whose partitions may repeat loans of the saved
+    // hot file. An archive pass names its months here before publishing them, and they are cleared
+    // once the hot file has been written without those loans.
+    void writeArchiveManifest(unsigned long long next, const set<string>& moving) const {
+        writeFileAtomically(archivePath(ARCHIVE_MANIFEST), [&](ofstream& file) {
+            file << "next," << next << '\n';
+            for (const auto& month : moving) {
+                file << "moving," << month << '\n';
+            }
+        });
+    }
+
+    // Drop the closed loans loaded from the hot file that an interrupted archive pass had already
+    // written to the partitions named in the manifest
+    void dropArchivedCopies() {
+        if (movingMonths.empty()) {
+            return;
+        }
+        unordered_set<string> archivedIDs;
+        {
+            lock_guard<mutex> lock(archiveMutex);
+            for (const auto& month : movingMonths) {
+                const TransactionStore& partition = archivedMonth(month);
+                for (size_t i = 0; i < partition.size(); i++) {
+                    archivedIDs.insert(partition.transactionID(i));
+                }
+            }
+        }
+        vector<bool> archived(transactions.size(), false);
+        bool any = false;
+        for (size_t i = 0; i < transactions.size(); i++) {
+            if (transactions.returnDate(i) != 0 && archivedIDs.count(transactions.transactionID(i))) {
+                archived[i] = true;
+                any = true;
+            }
+        }
+        if (any) {
+            transactions.removeIf([&archived](size_t slot) { return archived[slot]; });
+            rebuildLoanIndexes();
+            dirtyFiles |= TRANSACTIONS_FILE;
+        }
+    }
+
+    // Replay of an archive pass (journal replay, or a replica following the primary): the closed
+    // loans of these borrow months are in their partitions now, so drop them from memory and reread
+    // the partitions on the next history query
+    void applyArchivePass(const set<string>& months) {
+        vector<bool> archived(transactions.size(), false);
+        bool any = false;
+        for (size_t i = 0; i < transactions.size(); i++) {
+            if (transactions.returnDate(i) != 0 && months.count(monthOf(transactions.borrowDate(i)))) {
+                archived[i] = true;
+                any = true;
+            }
+        }
+        {
+            lock_guard<mutex> lock(archiveMutex);
+            for (const auto& month : months) {
+                archiveMonths.insert(month);
+                archivedLoans.erase(month);
+            }
+        }
+        if (any) {
+            if (!openSnapshots.empty()) {
+                expireSnapshots();  // they read loans by slot
+            }
+            transactions.removeIf([&archived](size_t slot) { return archived[slot]; });
+            rebuildLoanIndexes();
+            dirtyFiles |= TRANSACTIONS_FILE;
+        }
+    }
+
+    // One archived month, read from disk the first time it is asked for (caller holds archiveMutex)
+    const TransactionStore& archivedMonth(const string& month) const {
+        auto it = archivedLoans.find(month);
+        if (it != archivedLoans.end()) {
+            return it->second;
+        }
+        // A replica can read a partition the primary has just published before the records leading up
+        // to that archive pass reach it; loans it still holds in memory are left out, so each is seen
+        // once and as of the replica's own position in the journal
+        unordered_set<string> held;
+        if (options.persistence == PersistenceMode::Replica) {
+            for (size_t i = 0; i < transactions.size(); i++) {
+                if (monthOf(transactions.borrowDate(i)) == month) {
+                    held.insert(transactions.transactionID(i));
+                }
+            }
+        }
+        TransactionStore& store = archivedLoans[month];
+        forEachRecord(archivePath(partitionFile(month)), store, [&store, &held](const CsvParser& f) {
+            if (held.empty() || !held.count(f.str(0))) {
+                store.append(f[0], f[1], f[2], f.integer(3), f.integer(4), f.integer(5));
+            }
+        });
+        return store;
+    }
+
+    // Move closed loans borrowed before the hot window into their month partitions.
+    // Partitions are rewritten whole and skip IDs they already hold. The manifest names the
+    // months before they are published, so if the process stops before the hot file is saved
+    // again, the next start drops the loans it repeats (dropArchivedCopies). In journal mode
+    // the pass is logged, so replicas drop the same loans and reread the partitions.
+    bool archiveClosedLoans() {
+        LMS_TIME(ArchiveLoans);
+        if (options.hotMonths == 0 ||
+            (options.persistence != PersistenceMode::Journal && options.persistence != PersistenceMode::Snapshot)) {
+            return false;
+        }
+        string cutoff = monthOf(clock(), options.hotMonths - 1);
+        map<string, vector<size_t>> moving;  // month -> hot slots
+        vector<bool> archived(transactions.size(), false);
+        for (size_t i = 0; i < transactions.size(); i++) {
+            if (transactions.returnDate(i) != 0) {
+                string month = monthOf(transactions.borrowDate(i));
+                if (month < cutoff) {
+                    moving[month].push_back(i);
+                    archived[i] = true;
+                }
+            }
+        }
+        if (moving.empty()) {
+            return false;
+        }
+        // Open snapshots read loans by slot, so archiving waits for them, but only up to
+        // snapshotTimeout: after that the pass runs and the snapshots expire
+        if (!openSnapshots.empty()) {
+            auto openFor = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() -
+                                                                  openSnapshots.begin()->second);
+            if (openFor < options.snapshotTimeout) {
+                cerr << "Warning: archiving deferred; a snapshot has been open for " << openFor.count() << " s."
+                     << endl;
+                return false;
+            }
+            cerr << "Warning: expiring " << openSnapshots.size() << " snapshot(s) open for over "
+                 << options.snapshotTimeout.count() << " s to archive closed loans." << endl;
+            expireSnapshots();
+        }
+
+        filesystem::create_directories(archivePath(""));
+        for (const auto& partition : moving) {
+            movingMonths.insert(partition.first);
+        }
+        archivedNextTransaction = max(archivedNextTransaction, nextTransactionNumber);
+        writeArchiveManifest(archivedNextTransaction, movingMonths);
+        unique_lock<mutex> lock(archiveMutex);
+        for (const auto& partition : moving) {
+            const TransactionStore& existing = archivedMonth(partition.first);
+            unordered_set<string> known;
+            for (size_t i = 0; i < existing.size(); i++) {
+                known.insert(existing.transactionID(i));
+            }
+            TransactionStore& merged = archivedLoans[partition.first];
+            for (size_t slot : partition.second) {
+                if (known.insert(transactions.transactionID(slot)).second) {
+                    merged.append(transactions, slot);
+                }
+            }
+            writeFileAtomically(archivePath(partitionFile(partition.first)), [&merged](ofstream& file) {
+                for (size_t i = 0; i < merged.size(); i++) {
+                    file << merged[i].toString() << '\n';
+                }
+            });
+            archiveMonths.insert(partition.first);
+            archivedLoans.erase(partition.first);  // cold again until a history query needs it
+        }
+        lock.unlock();
+
+        transactions.removeIf([&archived](size_t slot) { return archived[slot]; });
+        rebuildLoanIndexes();
+        dirtyFiles |= TRANSACTIONS_FILE;
+        if (options.persistence == PersistenceMode::Journal) {
+            string record = "AR";
+            for (const auto& partition : moving) {
+                record += "," + partition.first;
+            }
+            try {
+                journal->append(to_string(lastLsn + 1) + "," + record);
+                lastLsn++;
+            } catch (const exception& e) {
+                // The primary's state is complete without it; a replica keeps the loans in memory
+                // and leaves them out of the partitions it reads
+                cerr << "Warning: archive pass not journaled: " << e.what() << endl;
+            }
+        }
+        return true;
+    }
+
+    // Visit archived transactions from the months in [firstMonth, lastMonth]
+    template <typename Visitor>
+    void forEachArchivedRecord(const string& firstMonth, const string& lastMonth, Visitor visit) const {
+        lock_guard<mutex> lock(archiveMutex);
+        for (auto month = archiveMonths.lower_bound(firstMonth); month != archiveMonths.end() && *month <= lastMonth;
+             ++month) {
+            const TransactionStore& partition = archivedMonth(*month);
+            for (size_t i = 0; i < partition.size(); i++) {
+                visit(TransactionRef(partition, i));
+            }
+        }
+    }
+
+    // Visit archived transactions from the months in [firstMonth, lastMonth], then the hot ones
+    template <typename Visitor>
+    void forEachHistoryRecord(const string& firstMonth, const string& lastMonth, Visitor visit) const {
+        forEachArchivedRecord(firstMonth, lastMonth, visit);
+        for (size_t i = 0; i < transactions.size(); i++) {
+            visit(TransactionRef(transactions, i));
+        }
+    }
+
+    // Count the loans in slots [begin, end) of a store into stats
+    void tallyLoans(const TransactionStore& store, size_t begin, size_t end, CirculationStats& stats) const {
+        // Count per interned handle first so each distinct ID is turned into a string once
+        vector<uint64_t> perBook(store.handleCount(), 0);
+        vector<uint64_t> perMember(store.handleCount(), 0);
+        long cachedDay = numeric_limits<long>::min();
+        uint64_t* monthCount = nullptr;
+        for (size_t i = begin; i < end; i++) {
+            perBook[store.bookHandle(i)]++;
+            perMember[store.memberHandle(i)]++;
+            time_t borrowed = store.borrowDate(i);
+            long day = static_cast<long>((borrowed >= 0 ? borrowed : borrowed - 86399) / 86400);
+            if (day != cachedDay) {
+                cachedDay = day;
+                monthCount = &stats.byMonth[monthIndex(borrowed)];
+            }
+            ++*monthCount;
+            if (store.returnDate(i) != 0) {
+                stats.recordReturn(store.borrowDate(i), store.returnDate(i), store.expectedReturnDate(i));
+            }
+        }
+        stats.loans += end - begin;
+        for (uint32_t handle = 0; handle < perBook.size(); handle++) {
+            if (perBook[handle]) {
+                stats.byBook.add(string(store.handleText(handle)), perBook[handle]);
+            }
+            if (perMember[handle]) {
+                stats.byMember.add(string(store.handleText(handle)), perMember[handle]);
+            }
+        }
+    }
+
+    // Rebuild the aggregates from every archived month and the in-memory loans in parallel:
+    // each worker reduces one partition (or one slice of the hot loans) and the partials are merged
+    void rebuildAnalytics() const {
+        size_t workerCount = max(1u, thread::hardware_concurrency());
+        vector<string> months(archiveMonths.begin(), archiveMonths.end());
+        size_t slices = min(workerCount, max<size_t>(1, transactions.size() / 65536 + 1));
+        vector<CirculationStats> partials(months.size() + slices);
+        vector<function<void()>> tasks;
+        for (size_t i = 0; i < months.size(); i++) {
+            tasks.push_back([this, &months, &partials, i] {
+                TransactionStore partition;
+                forEachRecord(archivePath(partitionFile(months[i])), partition, [&partition](const CsvParser& f) {
+                    partition.append(f[0], f[1], f[2], f.integer(3), f.integer(4), f.integer(5));
+                });
+                tallyLoans(partition, 0, partition.size(), partials[i]);
+            });
+        }
+        for (size_t slice = 0; slice < slices; slice++) {
+            tasks.push_back([this, &partials, &months, slice, slices] {
+                size_t begin = transactions.size() * slice / slices;
+                size_t end = transactions.size() * (slice + 1) / slices;
+                tallyLoans(transactions, begin, end, partials[months.size() + slice]);
+            });
+        }
+        runParallel(workerCount, move(tasks));
+        analytics.clear();
+        for (const auto& partial : partials) {
+            analytics.merge(partial);
+        }
+        for (const auto& entry : analytics.byBook.entries()) {
+            auto book = bookIndex.find(entry.first);
+            analytics.attribute(book != bookIndex.end() ? &books[book->second] : nullptr, entry.second);
+        }
+        analyticsStale = false;
+    }
+
+    // Rebuild a scanner from one text field of every record
+    template <typename T, typename GetText>
+    static void rebuildScanner(TextScanner& scanner, const vector<T>& records, GetText getText) {
+        size_t bytes = 0;
+        for (const auto& record : records) {
+            bytes += getText(record).size() + 1;
+        }
+        scanner.clear();
+        scanner.reserve(records.size(), bytes);
+        for (const auto& record : records) {
+            scanner.append(getText(record));
+        }
+    }
+
+    const TextScanner& titleScanner() const {
+        lock_guard<mutex> lock(scannerMutex);
+        if (bookTitlesStale) {
+            rebuildScanner(bookTitles, books, [](const Book& b) { return b.getTitle(); });
+            bookTitlesStale = false;
+        }
+        return bookTitles;
+    }
+
+    const TextScanner& nameScanner() const {
+        lock_guard<mutex> lock(scannerMutex);
+        if (memberNamesStale) {
+            rebuildScanner(memberNames, members, [](const Member& m) { return m.getName(); });
+            memberNamesStale = false;
+        }
+        return memberNames;
+    }
+
+    // Catalog slots of books whose ID equals the query or whose title contains it, in catalog order
+    vector<size_t> matchBooks(const string& query) const {
+        string folded = SearchIndex::fold(query);
+        if (folded.size() < 3) {
+            // Too short for the trigram index: scan the folded titles, then check the exact match
+            auto exact = bookIndex.find(query);
+            vector<size_t> slots = titleScanner().find(folded);
+            slots.erase(remove_if(slots.begin(), slots.end(),
+                                  [&](size_t slot) { return books[slot].getTitle().find(query) == string::npos; }),
+                        slots.end());
+            if (exact != bookIndex.end()) {
+                slots.insert(lower_bound(slots.begin(), slots.end(), exact->second), exact->second);
+                slots.erase(unique(slots.begin(), slots.end()), slots.end());
+            }
+            return slots;
+        }
+
+        // Narrow to titles containing every trigram of the query, then check the exact match
+        vector<size_t> slots;
+        auto exact = bookIndex.find(query);
+        if (exact != bookIndex.end()) {
+            slots.push_back(exact->second);
+        }
+        for (uint32_t document : searchIndex.substringCandidates(folded)) {
+            size_t slot = bookIndex.at(searchIndex.bookIDOf(document));
+            if (books[slot].getTitle().find(query) != string::npos) {
+                slots.push_back(slot);
+            }
+        }
+        sort(slots.begin(), slots.end());
+        slots.erase(unique(slots.begin(), slots.end()), slots.end());
+        return slots;
+    }
+
+    // Throw unless the member exists and the book exists and is on the shelf
+    void checkBorrowable(const string& memberID, const string& bookID) {
+        Book* book = lookupBook(bookID);
+        if (!book) {
+            throw runtime_error("Book not found.");
+        }
+        if (!lookupMember(memberID)) {
+            throw runtime_error("Member not found.");
+        }
+        if (!book->getAvailability()) {
+            throw runtime_error("Book is not available for borrowing.");
+        }
+    }
+
+    // Find the book to return by ID first, then by title, and check it is on loan
+    string resolveReturn(const string& bookIdentifier) {
+        string bookID;
+        if (lookupBook(bookIdentifier)) {
+            bookID = bookIdentifier;
+        } else {
+            vector<size_t> slots = matchBooks(bookIdentifier);
+            if (!slots.empty()) {
+                bookID = books[slots[0]].getBookID();
+            }
+        }
+        if (bookID.empty()) {
+            throw runtime_error("Book not found.");
+        }
+        if (findActiveTransaction(bookID) == transactions.size()) {
+            throw runtime_error("No active borrowing found for this book.");
+        }
+        return bookID;
+    }
+
+    // Slots of members whose ID is query or whose name contains it, in slot order
+    vector<size_t> matchMembers(const string& query) const {
+        auto exact = memberIndex.find(query);
+        vector<size_t> slots = nameScanner().find(SearchIndex::fold(query));
+        slots.erase(remove_if(slots.begin(), slots.end(),
+                              [&](size_t slot) { return members[slot].getName().find(query) == string::npos; }),
+                    slots.end());
+        if (exact != memberIndex.end()) {
+            slots.insert(lower_bound(slots.begin(), slots.end(), exact->second), exact->second);
+            slots.erase(unique(slots.begin(), slots.end()), slots.end());
+        }
+        return slots;
+    }
+
+    // Visit up to limit of the given ascending slots, starting at the first slot >= offset
+    template <typename Visitor>
+    static PageCursor walkSlots(const vector<size_t>& slots, size_t offset, size_t limit, Visitor visit) {
+        PageCursor cursor;
+        for (auto it = lower_bound(slots.begin(), slots.end(), offset); it != slots.end(); ++it) {
+            if (cursor.visited == limit) {
+                cursor.next = *it;
+                cursor.more = true;
+                return cursor;
+            }
+            visit(*it);
+            cursor.visited++;
+        }
+        cursor.next = slots.empty() ? offset : max(offset, slots.back() + 1);
+        return cursor;
+    }
+
+    // Visit up to limit of the slots in [offset, count) that satisfy keep
+    template <typename Keep, typename Visitor>
+    static PageCursor walkRange(size_t count, size_t offset, size_t limit, Keep keep, Visitor visit) {
+        PageCursor cursor;
+        for (size_t slot = offset; slot < count; slot++) {
+            if (!keep(slot)) {
+                continue;
+            }
+            if (cursor.visited == limit) {
+                cursor.next = slot;
+                cursor.more = true;
+                return cursor;
+            }
+            visit(slot);
+            cursor.visited++;
+        }
+        cursor.next = max(offset, count);
+        return cursor;
+    }
+
+    // Open loans as (book slot, transaction slot), in catalog order
+    vector<pair<size_t, size_t>> borrowedSlots() const {
+        vector<pair<size_t, size_t>> loans;
+        loans.reserve(activeLoanByBook.size());
+        for (const auto& loan : activeLoanByBook) {
+            auto book = bookIndex.find(loan.first);
+            if (book != bookIndex.end() && !books[book->second].getAvailability()) {
+                loans.push_back(make_pair(book->second, loan.second));
+            }
+        }
+        sort(loans.begin(), loans.end());
+        return loans;
+    }
+
+    // Apply and persist a bulk change with one write of the affected data files. In journal mode the
+    // records are logged with a single sync before anything is applied, so a failed write leaves the
+    // library unchanged and replicas following the journal receive them.
+    template <typename Apply>
+    void commitBulk(int dataFiles, const vector<string>& records, Apply apply) {
+        if (options.persistence == PersistenceMode::Journal) {
+            vector<string> numbered;
+            numbered.reserve(records.size());
+            unsigned long long lsn = lastLsn;
+            for (const auto& record : records) {
+                numbered.push_back(to_string(++lsn) + "," + record);
+            }
+            journal->append(numbered);
+            lastLsn = lsn;
+        }
+        apply();
+        version++;
+        dirtyFiles |= dataFiles;
+        if (options.persistence == PersistenceMode::Journal) {
+            checkpoint();
+        } else if (options.persistence == PersistenceMode::Snapshot) {
+            startSnapshot();
+        }
+    }
+
+    // Validate and stage a CSV batch, then apply it under one write lock with one persistence write
+    template <typename T, typename MakeRecord, typename GetID, typename Apply>
+    ImportReport importRecords(istream& in, const unordered_map<string, size_t>& index, int dataFiles,
+                               const char* journalOp, MakeRecord makeRecord, GetID getID, Apply apply) {
+        auto start = chrono::steady_clock::now();
+        ImportReport report;
+        vector<T> staged;
+        unordered_set<string> batchIDs;
+        forEachStreamedRecord(in, [&](const CsvParser& fields) {
+            report.rowsRead++;
+            if (report.rowsRead == 1) {
+                static const unordered_set<string> headers = {"id", "bookid", "book id", "book_id",
+                                                              "memberid", "member id", "member_id"};
+                if (headers.count(SearchIndex::fold(fields[0]))) {
+                    return;
+                }
+            }
+            if (fields.size() < 4 || fields[0].empty()) {
+                report.rejected++;
+                if (report.problems.size() < 10) {
+                    report.problems.push_back("Row " + to_string(report.rowsRead) + ": expected an ID and 3 fields.");
+                }
+                return;
+            }
+            if (!batchIDs.insert(fields.str(0)).second) {
+                report.duplicates++;
+                return;
+            }
+            staged.push_back(makeRecord(fields));
+        });
+
+        {
+            auto lock = writeLock();
+            requireWritable();
+            vector<const T*> accepted;
+            vector<string> records;
+            for (const auto& record : staged) {
+                if (index.count(getID(record))) {
+                    report.duplicates++;
+                } else {
+                    accepted.push_back(&record);
+                    if (options.persistence == PersistenceMode::Journal) {
+                        records.push_back(string(journalOp) + "," + record.toString());
+                    }
+                }
+            }
+            if (!accepted.empty()) {
+                commitBulk(dataFiles, records, [&] {
+                    for (const T* record : accepted) {
+                        apply(*record);
+                    }
+                });
+                report.imported = accepted.size();
+            }
+        }
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return report;
+    }
+
+    // Replicas change only by applying the primary's journal
+    void requireWritable() const {
+        if (options.persistence == PersistenceMode::Replica) {
+            throw runtime_error("This library is a read-only replica.");
+        }
+    }
+
+    // Slot of the open loan for a book, or transactions.size() if it is not on loan
+    size_t findActiveTransaction(const string& bookID) const {
+        auto it = activeLoanByBook.find(bookID);
+        return it != activeLoanByBook.end() ? it->second : transactions.size();
+    }
+
+    Book* lookupBook(const string& bookID) {
+        auto it = bookIndex.find(bookID);
+        return it != bookIndex.end() ? &books[it->second] : nullptr;
+    }
+
+    Member* lookupMember(const string& memberID) {
+        auto it = memberIndex.find(memberID);
+        return it != memberIndex.end() ? &members[it->second] : nullptr;
+    }
+
+    static string bookKey(const Book& b) { return b.getBookID(); }
+    static string memberKey(const Member& m) { return m.getMemberID(); }
+
+    // Keep the copy of a book or member that open snapshots see before the next version replaces it
+    template <typename T>
+    void keepVersion(unordered_map<string, vector<pair<uint64_t, T>>>& versions, const string& id, const T& record) {
+        if (!openSnapshots.empty()) {
+            versions[id].emplace_back(version + 1, record);
+        }
+    }
+
+    // The record with this ID as it was at version at: the earliest copy replaced after that
+    // version, or the current one
+    template <typename T>
+    static const T* versionOf(const unordered_map<string, vector<pair<uint64_t, T>>>& versions,
+                              const unordered_map<string, size_t>& index, const vector<T>& records,
+                              const string& id, uint64_t at) {
+        auto kept = versions.find(id);
+        if (kept != versions.end()) {
+            for (const auto& copy : kept->second) {
+                if (copy.first > at) {
+                    return &copy.second;
+                }
+            }
+        }
+        auto current = index.find(id);
+        return current != index.end() ? &records[current->second] : nullptr;
+    }
+
+    // Drop the kept versions that only snapshots older than oldest could see
+    template <typename T>
+    static void dropVersions(unordered_map<string, vector<pair<uint64_t, T>>>& versions, uint64_t oldest) {
+        for (auto it = versions.begin(); it != versions.end();) {
+            auto& copies = it->second;
+            copies.erase(remove_if(copies.begin(), copies.end(),
+                                   [oldest](const pair<uint64_t, T>& copy) { return copy.first <= oldest; }),
+                         copies.end());
+            it = copies.empty() ? versions.erase(it) : next(it);
+        }
+    }
+
+    void applyAddBook(const Book& book) {
+        if (bookIndex.emplace(book.getBookID(), books.size()).second) {
+            searchIndex.add(book);
+        }
+        books.push_back(book);
+        if (!bookTitlesStale) {
+            bookTitles.append(book.getTitle());
+        }
+    }
+
+    void applyEditBook(const string& bookID, const Book& updatedBook) {
+        auto it = bookIndex.find(bookID);
+        if (it == bookIndex.end()) {
+            throw runtime_error("Book not found.");
+        }
+        keepVersion(bookVersions, bookID, books[it->second]);
+        replaceIndexed(books, bookIndex, it->second, updatedBook, bookKey, "Book with this ID already exists.");
+        searchIndex.remove(bookID);
+        searchIndex.add(updatedBook);
+        bookTitlesStale = true;
+    }
+
+    void applyDeleteBook(const string& bookID) {
+        auto it = bookIndex.find(bookID);
+        if (it == bookIndex.end()) {
+            throw runtime_error("Book not found.");
+        }
+        keepVersion(bookVersions, bookID, books[it->second]);
+        eraseIndexed(books, bookIndex, it->second, bookKey);
+        bookTitlesStale = true;
+        searchIndex.remove(bookID);
+        auto duplicate = bookIndex.find(bookID);
+        if (duplicate != bookIndex.end()) {
+            searchIndex.add(books[duplicate->second]);
+        }
+    }
+
+    void applyAddMember(const Member& member) {
+        memberIndex.emplace(member.getMemberID(), members.size());
+        members.push_back(member);
+        if (!memberNamesStale) {
+            memberNames.append(member.getName());
+        }
+    }
+
+    void applyEditMember(const string& memberID, const Member& updatedMember) {
+        auto it = memberIndex.find(memberID);
+        if (it == memberIndex.end()) {
+            throw runtime_error("Member not found.");
+        }
+        keepVersion(memberVersions, memberID, members[it->second]);
+        replaceIndexed(members, memberIndex, it->second, updatedMember, memberKey,
+                       "Member with this ID already exists.");
+        memberNamesStale = true;
+    }
+
+    void applyDeleteMember(const string& memberID) {
+        auto it = memberIndex.find(memberID);
+        if (it == memberIndex.end()) {
+            throw runtime_error("Member not found.");
+        }
+        keepVersion(memberVersions, memberID, members[it->second]);
+        eraseIndexed(members, memberIndex, it->second, memberKey);
+        memberNamesStale = true;
+    }
+
+    void applyBorrow(const Transaction& transaction) {
+        Book* book = lookupBook(transaction.getBookID());
+        if (book) {
+            book->setAvailability(false);
+        }
+        transactions.push_back(transaction);
+        noteTransactionID(transaction.getTransactionID());
+        openLoan(transactions.size() - 1);
+        indexLoanDates(transactions.size() - 1);
+        if (!analyticsStale) {
+            analytics.recordBorrow(book, transaction.getBookID(), transaction.getMemberID(),
+                                   transaction.getBorrowDate());
+        }
+    }
+
+    void applyReturn(const string& bookID, time_t returnDate) {
+        size_t slot = findActiveTransaction(bookID);
+        if (slot == transactions.size()) {
+            throw runtime_error("No active borrowing found for this book.");
+        }
+        Book* book = lookupBook(bookID);
+        if (book) {
+            book->setAvailability(true);
+        }
+        closeLoan(slot);
+        if (!openSnapshots.empty()) {
+            returnVersions.emplace(slot, version + 1);
+        }
+        transactions.setReturnDate(slot, returnDate);
+        if (!analyticsStale) {
+            analytics.recordReturn(transactions.borrowDate(slot), returnDate, transactions.expectedReturnDate(slot));
+        }
+    }
+
+public:
+    Library(const LibraryOptions& opts = LibraryOptions()) : options(opts) {
+        if (options.persistence == PersistenceMode::None) {
+            return;
+        }
+        startup.threads = options.loadThreads ? options.loadThreads : max(1u, thread::hardware_concurrency());
+        auto phaseStart = chrono::steady_clock::now();
+        auto endPhase = [&phaseStart](double& ms) {
+            auto now = chrono::steady_clock::now();
+            ms = chrono::duration<double, milli>(now - phaseStart).count();
+            phaseStart = now;
+        };
+        if (options.persistence == PersistenceMode::Journal) {
+            recoverCheckpoint();
+        }
+        if (options.format == DataFormat::Binary) {
+            loadBinary();
+        } else {
+            loadTextFiles(startup.threads);
+        }
+        loadArchive();
+        LMS_COUNT(RecordsLoaded, books.size() + members.size() + transactions.size());
+        endPhase(startup.loadMs);
+        rebuildIndexes(startup.threads);
+        endPhase(startup.indexMs);
+        dropArchivedCopies();
+        if (options.persistence == PersistenceMode::Snapshot && (archiveClosedLoans() || dirtyFiles != 0)) {
+            flushDirtyFiles();
+        }
+        if (options.persistence == PersistenceMode::Journal) {
+            replayJournal();
+            journal.reset(new Journal(dataPath(options.dataDir, JOURNAL_FILE), options));
+            endPhase(startup.replayMs);
+        } else if (options.persistence == PersistenceMode::Replica) {
+            lastLsn = readCheckpointLsn();  // the follower applies the primary's records from here on
+        }
+    }
+
+    ~Library() {
+        waitForSnapshot();
+        try {
+            if (options.persistence == PersistenceMode::Journal) {
+                checkpoint();
+            } else if (options.persistence == PersistenceMode::Snapshot) {
+                flushDirtyFiles();
+            }
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+        }
+    }
+
+    Library(const Library&) = delete;
+    Library& operator=(const Library&) = delete;
+
+    // Phase timings of this library's startup
+    StartupTimings getStartupTimings() const {
+        return startup;
+    }
+
+    // Sequence number of the last journal record written (primary) or applied (replica)
+    unsigned long long getLastLsn() const {
+        auto lock = readLock();
+        return lastLsn;
+    }
+
+    // Apply journal records shipped from a primary, in order. Records this library already holds
+    // are skipped; a gap in the sequence means records were lost, and nothing more is applied.
+    void applyReplicatedRecords(const vector<vector<string>>& records) {
+        LMS_TIME(ReplicaApply);
+        auto lock = writeLock();
+        for (const auto& fields : records) {
+            unsigned long long lsn = stoull(fields.at(0));
+            if (lsn <= lastLsn) {
+                continue;
+            }
+            if (lsn != lastLsn + 1) {
+                throw runtime_error("Journal record " + to_string(lastLsn + 1) +
+                                    " is missing; the replica must be restarted.");
+            }
+            applyRecord(fields);
+            lastLsn = lsn;
+            version++;
+        }
+    }
+
+    // Replace the clock used for borrow/return dates and overdue reports
+    void setClock(Clock newClock) {
+        auto lock = writeLock();
+        clock = newClock;
+    }
+
+    // The library's current time, for overdue figures computed from the records it hands out
+    time_t currentTime() const {
+        auto lock = readLock();
+        return clock();
+    }
+
+    // Write the current state as data files in another directory and format
+    void writeSnapshot(const string& dir, DataFormat format) const {
+        auto lock = readLock();
+        saveData(ALL_FILES, dir, format);
+    }
+
+    // Throw if the loan indexes disagree with the books and transactions
+    void checkInvariants() const {
+        auto lock = readLock();
+        size_t openTransactions = 0;
+        for (size_t i = 0; i < transactions.size(); i++) {
+            openTransactions += transactions.returnDate(i) == 0;
+        }
+        if (openTransactions != activeLoanByBook.size()) {
+            throw runtime_error("Open transactions do not match the active loan index.");
+        }
+        size_t memberLoans = 0;
+        for (const auto& loans : activeLoansByMember) {
+            memberLoans += loans.second.size();
+        }
+        if (memberLoans != activeLoanByBook.size()) {
+            throw runtime_error("Member loan index does not match the active loan index.");
+        }
+        for (const auto& loan : activeLoanByBook) {
+            if (transactions.bookID(loan.second) != loan.first || transactions.returnDate(loan.second) != 0) {
+                throw runtime_error("Active loan index points at the wrong transaction.");
+            }
+        }
+        for (const auto& entry : bookIndex) {
+            if (books[entry.second].getAvailability() == (activeLoanByBook.count(entry.first) != 0)) {
+                throw runtime_error("Book " + entry.first + " availability disagrees with its loans.");
+            }
+        }
+    }
+
+    // Force buffered journal records to disk regardless of the sync policy; in snapshot mode,
+    // wait for the background writer and write whatever it has not picked up yet
+    void sync() {
+        auto lock = writeLock();
+        if (journal) {
+            journal->sync();
+        }
+        if (options.persistence == PersistenceMode::Snapshot) {
+            waitForSnapshot();
+            flushDirtyFiles();
+        }
+    }
+
+    // Add a new book to the library
+    void addBook(const Book& book) {
+        LMS_TIME(AddBook);
+        auto lock = writeLock();
+        requireWritable();
+        if (lookupBook(book.getBookID()) != nullptr) {
+            throw runtime_error("Book with this ID already exists.");
+        }
+        commit("AB," + book.toString(), BOOKS_FILE, [&] { applyAddBook(book); });
+    }
+
+    // Edit an existing book's details
+    void editBook(const string& bookID, const Book& updatedBook) {
+        LMS_TIME(EditBook);
+        auto lock = writeLock();
+        requireWritable();
+        checkReplace(bookIndex, bookID, updatedBook.getBookID(), "Book not found.",
+                     "Book with this ID already exists.");
+        commit("EB," + bookID + "," + updatedBook.toString(), BOOKS_FILE, [&] { applyEditBook(bookID, updatedBook); });
+    }
+
+    // Delete a book from the library
+    void deleteBook(const string& bookID) {
+        LMS_TIME(DeleteBook);
+        auto lock = writeLock();
+        requireWritable();
+        if (!lookupBook(bookID)) {
+            throw runtime_error("Book not found.");
+        }
+        commit("DB," + bookID, BOOKS_FILE, [&] { applyDeleteBook(bookID); });
+    }
+
+    // Import new books from CSV rows of id,title,author,genre; imported books start out available
+    ImportReport importBooks(istream& in) {
+        LMS_TIME(Import);
+        return importRecords<Book>(
+            in, bookIndex, BOOKS_FILE, "AB",
+            [](const CsvParser& f) { return Book(f.str(0), f.str(1), f.str(2), f.str(3)); }, bookKey,
+            [this](const Book& book) { applyAddBook(book); });
+    }
+
+    // Import new members from CSV rows of id,name,address,phone
+    ImportReport importMembers(istream& in) {
+        LMS_TIME(Import);
+        return importRecords<Member>(
+            in, memberIndex, MEMBERS_FILE, "AM",
+            [](const CsvParser& f) { return Member(f.str(0), f.str(1), f.str(2), f.str(3)); }, memberKey,
+            [this](const Member& member) { applyAddMember(member); });
+    }
+
+    // Stream every book as a CSV row
+    void exportBooks(ostream& out) const {
+        LMS_TIME(Export);
+        auto lock = readLock();
+        for (const auto& book : books) {
+            out << book.toString() << '\n';
+        }
+    }
+
+    // Stream every member as a CSV row
+    void exportMembers(ostream& out) const {
+        LMS_TIME(Export);
+        auto lock = readLock();
+        for (const auto& member : members) {
+            out << member.toString() << '\n';
+        }
+    }
+
+    // Get all books in the library
+    vector<Book> getAllBooks() const {
+        LMS_TIME(ListBooks);
+        auto lock = readLock();
+        return books;
+    }
+
+    // Find a book by its ID (the pointer is only valid until the next mutation)
+    Book* findBook(const string& bookID) {
+        LMS_TIME(FindBook);
+        auto lock = readLock();
+        return lookupBook(bookID);
+    }
+
+    // Add a new member to the library
+    void addMember(const Member& member) {
+        LMS_TIME(AddMember);
+        auto lock = writeLock();
+        requireWritable();
+        if (lookupMember(member.getMemberID()) != nullptr) {
+            throw runtime_error("Member with this ID already exists.");
+        }
+        commit("AM," + member.toString(), MEMBERS_FILE, [&] { applyAddMember(member); });
+    }
+
+    // Edit an existing member's details
+    void editMember(const string& memberID, const Member& updatedMember) {
+        LMS_TIME(EditMember);
+        auto lock = writeLock();
+        requireWritable();
+        checkReplace(memberIndex, memberID, updatedMember.getMemberID(), "Member not found.",
+                     "Member with this ID already exists.");
+        commit("EM," + memberID + "," + updatedMember.toString(), MEMBERS_FILE,
+               [&] { applyEditMember(memberID, updatedMember); });
+    }
+
+    // Delete a member from the library
+    void deleteMember(const string& memberID) {
+        LMS_TIME(DeleteMember);
+        auto lock = writeLock();
+        requireWritable();
+        if (!lookupMember(memberID)) {
+            throw runtime_error("Member not found.");
+        }
+        commit("DM," + memberID, MEMBERS_FILE, [&] { applyDeleteMember(memberID); });
+    }
+
+    // Get all members of the library
+    vector<Member> getAllMembers() const {
+        LMS_TIME(ListMembers);
+        auto lock = readLock();
+        return members;
+    }
+
+    // Find a member by their ID (the pointer is only valid until the next mutation)
+    Member* findMember(const string& memberID) {
+        LMS_TIME(FindMember);
+        auto lock = readLock();
+        return lookupMember(memberID);
+    }
+
+    // Borrow a book
+    string borrowBook(const string& memberID, const string& bookID) {
+        LMS_TIME(BorrowBook);
+        auto lock = writeLock();
+        requireWritable();
+        checkBorrowable(memberID, bookID);
+        string tID = to_string(nextTransactionNumber);
+        time_t now = clock();
+        Transaction transaction(tID, memberID, bookID, now, 0, now + (14 * 24 * 60 * 60));
+        commit("BR," + transaction.toString(), BOOKS_FILE | TRANSACTIONS_FILE, [&] { applyBorrow(transaction); });
+        return tID;  // Return the transaction ID
+    }
+
+    // Borrow several books for one member: either every book is lent or none is
+    vector<string> borrowBooks(const string& memberID, const vector<string>& bookIDs) {
+        LMS_TIME(BorrowBatch);
+        auto lock = writeLock();
+        requireWritable();
+        unordered_set<string> batch;
+        for (const auto& bookID : bookIDs) {
+            checkBorrowable(memberID, bookID);
+            if (!batch.insert(bookID).second) {
+                throw runtime_error("Book " + bookID + " appears twice in the batch.");
+            }
+        }
+        if (bookIDs.empty()) {
+            return vector<string>();
+        }
+
+        vector<string> transactionIDs;
+        vector<Transaction> loans;
+        string record = "BB";
+        time_t now = clock();
+        unsigned long long first = nextTransactionNumber;
+        for (size_t i = 0; i < bookIDs.size(); i++) {
+            transactionIDs.push_back(to_string(first + i));
+            loans.emplace_back(transactionIDs.back(), memberID, bookIDs[i], now, 0, now + (14 * 24 * 60 * 60));
+            record += "," + loans.back().toString();
+        }
+        commit(record, BOOKS_FILE | TRANSACTIONS_FILE, [&] {
+            for (const auto& loan : loans) {
+                applyBorrow(loan);
+            }
+        });
+        return transactionIDs;
+    }
+
+    // Return a borrowed book
+    void returnBook(const string& bookIdentifier) {
+        LMS_TIME(ReturnBook);
+        auto lock = writeLock();
+        requireWritable();
+        string bookID = resolveReturn(bookIdentifier);
+        time_t returnDate = clock();
+        commit("RT," + bookID + "," + to_string(returnDate), BOOKS_FILE | TRANSACTIONS_FILE,
+               [&] { applyReturn(bookID, returnDate); });
+    }
+
+    // Return several books: either every return is recorded or none is
+    void returnBooks(const vector<string>& bookIdentifiers) {
+        LMS_TIME(ReturnBatch);
+        auto lock = writeLock();
+        requireWritable();
+        vector<string> bookIDs;
+        unordered_set<string> batch;
+        for (const auto& identifier : bookIdentifiers) {
+            bookIDs.push_back(resolveReturn(identifier));
+            if (!batch.insert(bookIDs.back()).second) {
+                throw runtime_error("Book " + bookIDs.back() + " appears twice in the batch.");
+            }
+        }
+        if (bookIDs.empty()) {
+            return;
+        }
+
+        time_t returnDate = clock();
+        string record = "RB," + to_string(returnDate);
+        for (const auto& bookID : bookIDs) {
+            record += "," + csvField(bookID);
+        }
+        commit(record, BOOKS_FILE | TRANSACTIONS_FILE, [&] {
+            for (const auto& bookID : bookIDs) {
+                applyReturn(bookID, returnDate);
+            }
+        });
+    }
+
+    // Zero-copy reads: each visitor gets references into the library, valid only during the call.
+    // The library is read-locked for the whole walk, so a visitor must not call back into it.
+    // Walks start at position offset and stop after limit records; the returned cursor says where
+    // the next page starts.
+
+    // Visit books in catalog order
+    template <typename Visitor>
+    PageCursor visitBooks(Visitor visit, size_t offset = 0, size_t limit = SIZE_MAX) const {
+        LMS_TIME(ListBooks);
+        auto lock = readLock();
+        return walkRange(books.size(), offset, limit, [](size_t) { return true; },
+                         [&](size_t slot) { visit(books[slot]); });
+    }
+
+    // Visit books that are on the shelf
+    template <typename Visitor>
+    PageCursor visitAvailableBooks(Visitor visit, size_t offset = 0, size_t limit = SIZE_MAX) const {
+        LMS_TIME(AvailableBooks);
+        auto lock = readLock();
+        return walkRange(books.size(), offset, limit, [&](size_t slot) { return books[slot].getAvailability(); },
+                         [&](size_t slot) { visit(books[slot]); });
+    }
+
+    // Visit books whose ID is query or whose title contains it
+    template <typename Visitor>
+    PageCursor visitBookMatches(const string& query, Visitor visit, size_t offset = 0,
+                                size_t limit = SIZE_MAX) const {
+        LMS_TIME(SearchBooks);
+        auto lock = readLock();
+        return walkSlots(matchBooks(query), offset, limit, [&](size_t slot) { visit(books[slot]); });
+    }
+
+    // Visit members in registration order
+    template <typename Visitor>
+    PageCursor visitMembers(Visitor visit, size_t offset = 0, size_t limit = SIZE_MAX) const {
+        LMS_TIME(ListMembers);
+        auto lock = readLock();
+        return walkRange(members.size(), offset, limit, [](size_t) { return true; },
+                         [&](size_t slot) { visit(members[slot]); });
+    }
+
+    // Visit members whose ID is query or whose name contains it
+    template <typename Visitor>
+    PageCursor visitMemberMatches(const string& query, Visitor visit, size_t offset = 0,
+                                  size_t limit = SIZE_MAX) const {
+        LMS_TIME(SearchMembers);
+        auto lock = readLock();
+        return walkSlots(matchMembers(query), offset, limit, [&](size_t slot) { visit(members[slot]); });
+    }
+
+    // Visit the in-memory (open and recent) transactions in the order they were recorded;
+    // archived history is reached through visitHistory
+    template <typename Visitor>
+    PageCursor visitTransactions(Visitor visit, size_t offset = 0, size_t limit = SIZE_MAX) const {
+        LMS_TIME(ListTransactions);
+        auto lock = readLock();
+        return walkRange(transactions.size(), offset, limit, [](size_t) { return true; },
+                         [&](size_t slot) { visit(TransactionRef(transactions, slot)); });
+    }
+
+    // Visit borrowed books with their open loans in catalog order; the cursor counts book positions
+    template <typename Visitor>
+    PageCursor visitBorrowedBooks(Visitor visit, size_t offset = 0, size_t limit = SIZE_MAX) const {
+        LMS_TIME(BorrowedBooks);
+        auto lock = readLock();
+        vector<pair<size_t, size_t>> loans = borrowedSlots();
+        vector<size_t> slots;
+        slots.reserve(loans.size());
+        for (const auto& loan : loans) {
+            slots.push_back(loan.first);
+        }
+        return walkSlots(slots, offset, limit, [&](size_t slot) {
+            auto loan = lower_bound(loans.begin(), loans.end(), make_pair(slot, size_t(0)));
+            visit(books[slot], TransactionRef(transactions, loan->second));
+        });
+    }
+
+    // Get all transactions, including archived history (loads every archived month)
+    vector<Transaction> getAllTransactions() const {
+        LMS_TIME(ListTransactions);
+        auto lock = readLock();
+        vector<Transaction> all;
+        all.reserve(transactions.size());
+        forEachHistoryRecord("", "~", [&all](const TransactionRef& t) { all.push_back(t.toTransaction()); });
+        return all;
+    }
+
+    // Months with archived history, oldest first
+    vector<string> getArchivedMonths() const {
+        auto lock = readLock();
+        return vector<string>(archiveMonths.begin(), archiveMonths.end());
+    }
+
+    // Visit transactions borrowed in [from, to): the archived months that range covers, then the
+    // in-memory loans through the borrow date index, earliest first
+    template <typename Visitor>
+    void visitHistory(time_t from, time_t to, Visitor visit) const {
+        LMS_TIME(DateRange);
+        auto lock = readLock();
+        if (from >= to) {
+            return;
+        }
+        forEachArchivedRecord(monthOf(from), monthOf(to - 1), [&](const TransactionRef& t) {
+            if (t.getBorrowDate() >= from && t.getBorrowDate() < to) {
+                visit(t);
+            }
+        });
+        walkDateRange(loansByBorrowDate.range(from, to), 0, SIZE_MAX, visit);
+    }
+
+    // Visit a member's loans borrowed in [from, to): archived months first, then the in-memory ones
+    // through the member's date index, earliest first
+    template <typename Visitor>
+    void visitMemberHistory(const string& memberID, time_t from, time_t to, Visitor visit) const {
+        LMS_TIME(MemberHistory);
+        auto lock = readLock();
+        if (from >= to) {
+            return;
+        }
+        forEachArchivedRecord(monthOf(from), monthOf(to - 1), [&](const TransactionRef& t) {
+            if (t.getBorrowDate() >= from && t.getBorrowDate() < to && t.getMemberID() == memberID) {
+                visit(t);
+            }
+        });
+        walkDateRange(memberLoanRange(memberID, from, to), 0, SIZE_MAX, visit);
+    }
+
+    // Visit the in-memory loans borrowed in [from, to), earliest first
+    template <typename Visitor>
+    PageCursor visitLoansBorrowed(time_t from, time_t to, Visitor visit, size_t offset = 0,
+                                  size_t limit = SIZE_MAX) const {
+        LMS_TIME(DateRange);
+        auto lock = readLock();
+        return walkDateRange(loansByBorrowDate.range(from, to), offset, limit, visit);
+    }
+
+    // Visit the in-memory loans, open or returned, expected back in [from, to), earliest first
+    template <typename Visitor>
+    PageCursor visitLoansDue(time_t from, time_t to, Visitor visit, size_t offset = 0, size_t limit = SIZE_MAX) const {
+        LMS_TIME(DateRange);
+        auto lock = readLock();
+        return walkDateRange(loansByDueDate.range(from, to), offset, limit, visit);
+    }
+
+    // Every loan a member has taken out, archived ones included, oldest first
+    vector<Transaction> getMemberHistory(const string& memberID) const {
+        LMS_TIME(MemberHistory);
+        auto lock = readLock();
+        vector<Transaction> history;
+        forEachArchivedRecord("", "~", [&](const TransactionRef& t) {
+            if (t.getMemberID() == memberID) {
+                history.push_back(t.toTransaction());
+            }
+        });
+        time_t earliest = numeric_limits<time_t>::min();
+        time_t latest = numeric_limits<time_t>::max();
+        walkDateRange(memberLoanRange(memberID, earliest, latest), 0, SIZE_MAX,
+                      [&history](const TransactionRef& t) { history.push_back(t.toTransaction()); });
+        stable_sort(history.begin(), history.end(), [](const Transaction& a, const Transaction& b) {
+            return a.getBorrowDate() < b.getBorrowDate();
+        });
+        return history;
+    }
+
+    // Circulation statistics with the top entries of each ranking
+    CirculationReport getCirculationReport(size_t top = 10) const {
+        LMS_TIME(CirculationReport);
+        auto lock = readLock();
+        lock_guard<mutex> analyticsLock(analyticsMutex);
+        if (analyticsStale) {
+            rebuildAnalytics();
+        }
+        CirculationReport report;
+        report.loansByGenre = analytics.byGenre.top(analytics.byGenre.size());
+        report.topAuthors = analytics.byAuthor.top(top);
+        for (const auto& entry : analytics.byBook.top(top)) {
+            auto book = bookIndex.find(entry.first);
+            report.topTitles.push_back(
+                make_pair(book != bookIndex.end() ? books[book->second].getTitle() : entry.first, entry.second));
+        }
+        for (const auto& entry : analytics.byMember.top(top)) {
+            auto member = memberIndex.find(entry.first);
+            report.topMembers.push_back(
+                make_pair(member != memberIndex.end() ? members[member->second].getName() : entry.first,
+                          entry.second));
+        }
+        for (const auto& month : analytics.byMonth) {
+            report.loansByMonth.push_back(make_pair(monthName(month.first), month.second));
+        }
+        report.totalLoans = analytics.loans;
+        report.openLoans = analytics.loans - analytics.returned;
+        report.averageLoanDays =
+            analytics.returned ? analytics.loanSeconds / analytics.returned / (24 * 60 * 60) : 0;
+        report.feesCharged = analytics.feesCharged;
+        time_t now = clock();
+        overdueEngine.forEachDueBy(now, [&](size_t slot) {
+            report.feesOutstanding += TransactionRef(transactions, slot).calculateOverdueFees(now);
+        });
+        return report;
+    }
+
+    // Search for books by ID or title
+    vector<Book> searchBooks(const string& query) const {
+        LMS_TIME(SearchBooks);
+        auto lock = readLock();
+        vector<Book> results;
+        for (size_t slot : matchBooks(query)) {
+            results.push_back(books[slot]);
+        }
+        return results;
+    }
+
+    // Ranked, case-insensitive search over book IDs, titles, authors and genres
+    SearchPage searchCatalog(const string& query, size_t offset, size_t limit) const {
+        LMS_TIME(SearchBooks);
+        auto lock = readLock();
+        vector<pair<int, size_t>> ranked;  // (score, slot)
+        auto exact = bookIndex.find(query);
+        for (const auto& hit : searchIndex.search(query)) {
+            size_t slot = bookIndex.at(hit.bookID);
+            if (exact == bookIndex.end() || slot != exact->second) {
+                ranked.push_back(make_pair(hit.score, slot));
+            }
+        }
+        if (exact != bookIndex.end()) {
+            ranked.push_back(make_pair(numeric_limits<int>::max(), exact->second));
+        }
+
+        auto better = [](const pair<int, size_t>& a, const pair<int, size_t>& b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        };
+        SearchPage page;
+        page.totalMatches = ranked.size();
+        size_t first = min(offset, ranked.size());
+        size_t last = min(ranked.size(), first + limit);
+        partial_sort(ranked.begin(), ranked.begin() + last, ranked.end(), better);
+        for (size_t i = first; i < last; i++) {
+            page.books.push_back(books[ranked[i].second]);
+            page.scores.push_back(ranked[i].first);
+        }
+        return page;
+    }
+
+    // Search for members by ID or name
+    vector<Member> searchMembers(const string& query) const {
+        LMS_TIME(SearchMembers);
+        auto lock = readLock();
+        vector<Member> results;
+        for (size_t slot : matchMembers(query)) {
+            results.push_back(members[slot]);
+        }
+        return results;
+    }
+
+    // Get all available books
+    vector<Book> getAvailableBooks() const {
+        LMS_TIME(AvailableBooks);
+        auto lock = readLock();
+        vector<Book> availableBooks;
+        copy_if(books.begin(), books.end(), back_inserter(availableBooks),
+                [](const Book& b) { return b.getAvailability(); });
+        return availableBooks;
+    }
+
+    // Get all borrowed books with their transaction details
+    vector<pair<Book, Transaction>> getBorrowedBooksWithTransactions() const {
+        LMS_TIME(BorrowedBooks);
+        auto lock = readLock();
+        vector<pair<size_t, size_t>> loans = borrowedSlots();
+        vector<pair<Book, Transaction>> borrowedBooks;
+        borrowedBooks.reserve(loans.size());
+        for (const auto& loan : loans) {
+            borrowedBooks.push_back(make_pair(books[loan.first], transactions[loan.second]));
+        }
+        return borrowedBooks;
+    }
+
+    // Get the open loans of a member, oldest first
+    vector<Transaction> getActiveLoans(const string& memberID) const {
+        LMS_TIME(ActiveLoans);
+        auto lock = readLock();
+        vector<Transaction> loans;
+        auto it = activeLoansByMember.find(memberID);
+        if (it == activeLoansByMember.end()) {
+            return loans;
+        }
+        vector<size_t> slots(it->second.begin(), it->second.end());
+        sort(slots.begin(), slots.end());
+        for (size_t slot : slots) {
+            loans.push_back(transactions[slot]);
+        }
+        return loans;
+    }
+
+
+    // Get members with overdue books and their total fees, most overdue first
+    vector<pair<Member, double>> getOverdueMembers() const {
+        LMS_TIME(OverdueMembers);
+        auto lock = readLock();
+        time_t now = clock();
+        time_t cutoff = now - static_cast<time_t>(OVERDUE_REPORT_DAYS + 1) * 24 * 60 * 60;
+        vector<pair<Member, double>> overdueMembers;
+        unordered_map<string, size_t> positions;  // memberID -> slot in overdueMembers
+        overdueEngine.forEachDueBy(cutoff, [&](size_t slot) {
+            Transaction transaction = transactions[slot];
+            auto known = positions.find(transaction.getMemberID());
+            if (known != positions.end()) {
+                overdueMembers[known->second].second += transaction.calculateOverdueFees(now);
+                return;
+            }
+            auto member = memberIndex.find(transaction.getMemberID());
+            if (member != memberIndex.end()) {
+                positions.emplace(transaction.getMemberID(), overdueMembers.size());
+                overdueMembers.push_back(make_pair(members[member->second], transaction.calculateOverdueFees(now)));
+            }
+        });
+        return overdueMembers;
+    }
+
+    // Snapshot class to read the loans and fees as they stood at one version of the library and one
+    // moment in time, unaffected by commits made after it was opened. Obtain one from openSnapshot;
+    // it must not outlive the library. asOf only selects which loans were out: books and members are
+    // shown as they were at the snapshot's version, not as they were on that date. A snapshot kept
+    // open past LibraryOptions::snapshotTimeout may expire, after which its reads throw.
+    class Snapshot {
+    private:
+        Library& library;
+        uint64_t version;
+        uint64_t epoch;
+        size_t loanCount;  // loan slots that existed at the version
+        time_t asOf;
+
+        friend class Library;
+        Snapshot(Library& owner, uint64_t at, uint64_t generation, size_t loans, time_t when)
+            : library(owner), version(at), epoch(generation), loanCount(loans), asOf(when) {}
+
+    public:
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        ~Snapshot() { library.closeSnapshot(version, epoch); }
+
+        uint64_t getVersion() const { return version; }
+        time_t getTime() const { return asOf; }
+
+        // Visit the loans that were out at the snapshot time, archived ones first, as (book, loan)
+        // pairs; a loan returned after that time is reported with no return date
+        template <typename Visitor>
+        PageCursor visitOpenLoans(Visitor visit, size_t offset = 0, size_t limit = SIZE_MAX) const {
+            return library.visitSnapshotLoans(version, epoch, loanCount, asOf, visit, offset, limit);
+        }
+
+        // Members owing overdue fees at the snapshot time and the amount, largest first. Like
+        // getOverdueMembers, only loans more than OVERDUE_REPORT_DAYS past due count.
+        vector<pair<Member, double>> getFeesOwed() const {
+            time_t cutoff = asOf - static_cast<time_t>(OVERDUE_REPORT_DAYS + 1) * 24 * 60 * 60;
+            unordered_map<string, double> fees;
+            visitOpenLoans([&](const Book&, const Transaction& loan) {
+                double owed = loan.calculateOverdueFees(asOf);
+                if (loan.getExpectedReturnDate() <= cutoff && owed > 0) {
+                    fees[loan.getMemberID()] += owed;
+                }
+            });
+            vector<pair<Member, double>> owing;
+            {
+                auto lock = library.readLock();
+                library.checkSnapshot(epoch);
+                for (const auto& entry : fees) {
+                    const Member* member = versionOf(library.memberVersions, library.memberIndex, library.members,
+                                                     entry.first, version);
+                    owing.push_back(make_pair(member ? *member : Member(entry.first, "", "", ""), entry.second));
+                }
+            }
+            sort(owing.begin(), owing.end(), [](const pair<Member, double>& a, const pair<Member, double>& b) {
+                return a.second != b.second ? a.second > b.second : a.first.getMemberID() < b.first.getMemberID();
+            });
+            return owing;
+        }
+    };
+
+    // Open a read-only view of the current version as of asOf (now when 0). Commits made while it is
+    // open keep the values it can see, and archiving of closed loans waits until it is released or
+    // has been open for LibraryOptions::snapshotTimeout.
+    shared_ptr<Snapshot> openSnapshot(time_t asOf = 0) {
+        auto lock = writeLock();
+        openSnapshots.emplace(version, chrono::steady_clock::now());
+        return shared_ptr<Snapshot>(
+            new Snapshot(*this, version, snapshotEpoch, transactions.size(), asOf != 0 ? asOf : clock()));
+    }
+
+private:
+    // Release a snapshot and drop the kept values no remaining snapshot can see
+    void closeSnapshot(uint64_t at, uint64_t epoch) {
+        auto lock = writeLock();
+        if (epoch != snapshotEpoch) {
+            return;  // expired; its entry and kept values are already gone
+        }
+        openSnapshots.erase(openSnapshots.find(at));
+        uint64_t oldest = openSnapshots.empty() ? numeric_limits<uint64_t>::max() : openSnapshots.begin()->first;
+        dropVersions(bookVersions, oldest);
+        dropVersions(memberVersions, oldest);
+        for (auto it = returnVersions.begin(); it != returnVersions.end();) {
+            it = it->second <= oldest ? returnVersions.erase(it) : next(it);
+        }
+    }
+
+    // Drop every open snapshot and the values kept for them; their later reads throw
+    void expireSnapshots() {
+        snapshotEpoch++;
+        openSnapshots.clear();
+        returnVersions.clear();
+        bookVersions.clear();
+        memberVersions.clear();
+    }
+
+    void checkSnapshot(uint64_t epoch) const {
+        if (epoch != snapshotEpoch) {
+            throw runtime_error("The snapshot expired because closed loans were archived; open a new one.");
+        }
+    }
+
+    // Walk the loans open at asOf as seen by the version at: archived loans borrowed by then and
+    // returned after it, then the first loanCount in-memory slots. Matches are gathered in batches
+    // under the read lock and handed to the visitor after it is released, so a long scan does not
+    // hold up writers.
+    template <typename Visitor>
+    PageCursor visitSnapshotLoans(uint64_t at, uint64_t epoch, size_t loanCount, time_t asOf, Visitor visit,
+                                  size_t offset, size_t limit) const {
+        LMS_TIME(SnapshotRead);
+        const size_t BATCH = 4096;
+        PageCursor cursor;
+        vector<pair<Book, Transaction>> batch;
+        auto resolve = [&](const TransactionRef& t) {
+            string bookID(t.getBookID());
+            const Book* book = versionOf(bookVersions, bookIndex, books, bookID, at);
+            batch.emplace_back(book ? *book : Book(bookID, "", "", ""),
+                               Transaction(t.getTransactionID(), string(t.getMemberID()), bookID, t.getBorrowDate(),
+                                           0, t.getExpectedReturnDate()));
+            batch.back().first.setAvailability(false);
+        };
+        auto consider = [&](const TransactionRef& t, time_t returned) {
+            if (t.getBorrowDate() > asOf || (returned != 0 && returned <= asOf)) {
+                return;
+            }
+            if (cursor.next++ < offset) {
+                return;
+            }
+            if (cursor.visited + batch.size() == limit) {
+                cursor.more = true;
+                return;
+            }
+            resolve(t);
+        };
+        auto flush = [&] {
+            for (const auto& loan : batch) {
+                visit(loan.first, loan.second);
+            }
+            cursor.visited += batch.size();
+            batch.clear();
+        };
+
+        {
+            auto lock = readLock();
+            checkSnapshot(epoch);
+            forEachArchivedRecord("", monthOf(asOf), [&](const TransactionRef& t) {
+                if (!cursor.more) {
+                    consider(t, t.getReturnDate());
+                }
+            });
+        }
+        flush();
+        for (size_t first = 0; first < loanCount && !cursor.more; first += BATCH) {
+            {
+                auto lock = readLock();
+                checkSnapshot(epoch);
+                for (size_t slot = first; slot < min(loanCount, first + BATCH) && !cursor.more; slot++) {
+                    time_t returned = transactions.returnDate(slot);
+                    auto closed = returnVersions.find(slot);
+                    if (closed != returnVersions.end() && closed->second > at) {
+                        returned = 0;  // returned after the snapshot's version
+                    }
+                    consider(TransactionRef(transactions, slot), returned);
+                }
+            }
+            flush();
+        }
+        if (cursor.more) {
+            cursor.next--;  // the match that did not fit starts the next page
+        }
+        return cursor;
+    }
+};
+
+// ShardedLibrary class to run several branches as independent Library partitions, each with its
+// own data directory and persistence. Operations on one book or member go to the branch that owns
+// the ID; searches are fanned out to every branch on a thread pool and the results merged.
+class ShardedLibrary {
+private:
+    vector<string> branchNames;
+    vector<unique_ptr<Library>> shards;
+    unordered_map<string, size_t> bookBranch;    // book ID -> owning shard
+    unordered_map<string, size_t> memberBranch;  // member ID -> owning shard
+    LibraryOptions options;
+    mutable shared_mutex routerMutex;  // guards the two directories (only in thread-safe mode)
+    mutable ThreadPool pool;
+
+    static constexpr const char* BRANCHES_FILE = "branches.txt";
+
+    shared_lock<shared_mutex> readLock() const {
+        return options.threadSafe ? shared_lock<shared_mutex>(routerMutex) : shared_lock<shared_mutex>();
+    }
+
+    unique_lock<shared_mutex> writeLock() {
+        return options.threadSafe ? unique_lock<shared_mutex>(routerMutex) : unique_lock<shared_mutex>();
+    }
+
+    static size_t route(const unordered_map<string, size_t>& directory, const string& id, const char* kind) {
+        auto it = directory.find(id);
+        if (it == directory.end()) {
+            throw runtime_error(string(kind) + " not found.");
+        }
+        return it->second;
+    }
+
+    size_t branchSlot(const string& branch) const {
+        auto it = find(branchNames.begin(), branchNames.end(), branch);
+        if (it == branchNames.end()) {
+            throw runtime_error("Unknown branch " + branch + ".");
+        }
+        return static_cast<size_t>(it - branchNames.begin());
+    }
+
+    // Run query on every shard concurrently and return the results in branch order
+    template <typename Query>
+    auto scatter(Query query) const -> vector<decltype(query(declval<const Library&>()))> {
+        using Result = decltype(query(declval<const Library&>()));
+        vector<future<Result>> pending;
+        for (const auto& shard : shards) {
+            auto task = make_shared<packaged_task<Result()>>([&query, &shard] { return query(*shard); });
+            pending.push_back(task->get_future());
+            pool.submit([task] { (*task)(); });
+        }
+        vector<Result> results;
+        for (auto& result : pending) {
+            results.push_back(result.get());
+        }
+        return results;
+    }
+
+public:
+    // Open the given branches under options.dataDir (one subdirectory each). With no branch names
+    // the list saved in branches.txt by an earlier run is used.
+    ShardedLibrary(const LibraryOptions& opts, vector<string> branches)
+        : branchNames(move(branches)), options(opts),
+          pool(max<size_t>(1, min<size_t>(branchNames.empty() ? 1 : branchNames.size(),
+                                           max(1u, thread::hardware_concurrency())))) {
+        bool persistent = options.persistence != PersistenceMode::None;
+        string listPath = dataPath(options.dataDir, BRANCHES_FILE);
+        if (branchNames.empty() && persistent) {
+            ifstream list(listPath);
+            string name;
+            while (getline(list, name)) {
+                if (!name.empty()) {
+                    branchNames.push_back(name);
+                }
+            }
+        }
+        if (branchNames.empty()) {
+            throw runtime_error("A sharded library needs at least one branch.");
+        }
+        for (const auto& name : branchNames) {
+            if (name.empty() || name.find_first_of("/\\.") != string::npos) {
+                throw runtime_error("Invalid branch name " + name + ".");
+            }
+        }
+        if (options.persistence == PersistenceMode::Journal || options.persistence == PersistenceMode::Snapshot) {
+            if (!options.dataDir.empty()) {
+                filesystem::create_directories(options.dataDir);
+            }
+            writeFileAtomically(listPath, [this](ofstream& file) {
+                for (const auto& name : branchNames) {
+                    file << name << '\n';
+                }
+            });
+        }
+
+        // Open the branches in parallel; each one loads its own files
+        shards.resize(branchNames.size());
+        vector<function<void()>> tasks;
+        for (size_t i = 0; i < branchNames.size(); i++) {
+            tasks.push_back([this, i] {
+                LibraryOptions branchOptions = options;
+                branchOptions.dataDir = dataPath(options.dataDir, branchNames[i]);
+                if (branchOptions.persistence != PersistenceMode::None) {
+                    filesystem::create_directories(branchOptions.dataDir);
+                }
+                shards[i].reset(new Library(branchOptions));
+            });
+        }
+        runParallel(pool.size(), move(tasks));
+
+        for (size_t i = 0; i < shards.size(); i++) {
+            shards[i]->visitBooks([&](const Book& book) {
+                if (!bookBranch.emplace(book.getBookID(), i).second) {
+                    throw runtime_error("Book " + book.getBookID() + " is held by more than one branch.");
+                }
+            });
+            shards[i]->visitMembers([&](const Member& member) {
+                if (!memberBranch.emplace(member.getMemberID(), i).second) {
+                    throw runtime_error("Member " + member.getMemberID() + " is registered at more than one branch.");
+                }
+            });
+        }
+    }
+
+    ShardedLibrary(const ShardedLibrary&) = delete;
+    ShardedLibrary& operator=(const ShardedLibrary&) = delete;
+
+    const vector<string>& getBranches() const {
+        return branchNames;
+    }
+
+    // The partition of one branch, for branch-local reports
+    Library& branch(const string& name) {
+        return *shards[branchSlot(name)];
+    }
+
+    string getBookBranch(const string& bookID) const {
+        auto lock = readLock();
+        return branchNames[route(bookBranch, bookID, "Book")];
+    }
+
+    string getMemberBranch(const string& memberID) const {
+        auto lock = readLock();
+        return branchNames[route(memberBranch, memberID, "Member")];
+    }
+
+    void addBook(const string& branchName, const Book& book) {
+        size_t slot = branchSlot(branchName);
+        auto lock = writeLock();
+        if (bookBranch.count(book.getBookID())) {
+            throw runtime_error("Book with this ID already exists.");
+        }
+        shards[slot]->addBook(book);
+        bookBranch.emplace(book.getBookID(), slot);
+    }
+
+    void editBook(const string& bookID, const Book& updatedBook) {
+        auto lock = writeLock();
+        size_t slot = route(bookBranch, bookID, "Book");
+        if (updatedBook.getBookID() != bookID && bookBranch.count(updatedBook.getBookID())) {
+            throw runtime_error("Book with this ID already exists.");
+        }
+        shards[slot]->editBook(bookID, updatedBook);
+        bookBranch.erase(bookID);
+        bookBranch.emplace(updatedBook.getBookID(), slot);
+    }
+
+    void deleteBook(const string& bookID) {
+        auto lock = writeLock();
+        shards[route(bookBranch, bookID, "Book")]->deleteBook(bookID);
+        bookBranch.erase(bookID);
+    }
+
+    void addMember(const string& branchName, const Member& member) {
+        size_t slot = branchSlot(branchName);
+        auto lock = writeLock();
+        if (memberBranch.count(member.getMemberID())) {
+            throw runtime_error("Member with this ID already exists.");
+        }
+        shards[slot]->addMember(member);
+        memberBranch.emplace(member.getMemberID(), slot);
+    }
+
+    void editMember(const string& memberID, const Member& updatedMember) {
+        auto lock = writeLock();
+        size_t slot = route(memberBranch, memberID, "Member");
+        if (updatedMember.getMemberID() != memberID && memberBranch.count(updatedMember.getMemberID())) {
+            throw runtime_error("Member with this ID already exists.");
+        }
+        shards[slot]->editMember(memberID, updatedMember);
+        memberBranch.erase(memberID);
+        memberBranch.emplace(updatedMember.getMemberID(), slot);
+    }
+
+    void deleteMember(const string& memberID) {
+        auto lock = writeLock();
+        shards[route(memberBranch, memberID, "Member")]->deleteMember(memberID);
+        memberBranch.erase(memberID);
+    }
+
+    // Find a book in its owning branch (the pointer is only valid until that branch's next mutation)
+    Book* findBook(const string& bookID) {
+        auto lock = readLock();
+        auto it = bookBranch.find(bookID);
+        return it == bookBranch.end() ? nullptr : shards[it->second]->findBook(bookID);
+    }
+
+    Member* findMember(const string& memberID) {
+        auto lock = readLock();
+        auto it = memberBranch.find(memberID);
+        return it == memberBranch.end() ? nullptr : shards[it->second]->findMember(memberID);
+    }
+
+    // Borrow a book from the branch that holds it; members borrow from their own branch
+    string borrowBook(const string& memberID, const string& bookID) {
+        auto lock = readLock();
+        size_t slot = route(bookBranch, bookID, "Book");
+        if (route(memberBranch, memberID, "Member") != slot) {
+            throw runtime_error("Member " + memberID + " belongs to another branch than book " + bookID + ".");
+        }
+        return shards[slot]->borrowBook(memberID, bookID);
+    }
+
+    void returnBook(const string& bookID) {
+        auto lock = readLock();
+        shards[route(bookBranch, bookID, "Book")]->returnBook(bookID);
+    }
+
+    // Ranked catalog search across every branch: each branch ranks its first offset + limit hits
+    // in parallel, and the pages are merged by score (ties keep branch order)
+    SearchPage searchCatalog(const string& query, size_t offset, size_t limit) const {
+        size_t wanted = offset + min(limit, SIZE_MAX - offset);
+        vector<SearchPage> pages = scatter([&](const Library& shard) { return shard.searchCatalog(query, 0, wanted); });
+        struct Hit {
+            int score;
+            size_t page;
+            size_t position;
+        };
+        vector<Hit> hits;
+        SearchPage merged;
+        for (size_t p = 0; p < pages.size(); p++) {
+            merged.totalMatches += pages[p].totalMatches;
+            for (size_t i = 0; i < pages[p].books.size(); i++) {
+                hits.push_back(Hit{pages[p].scores[i], p, i});
+            }
+        }
+        stable_sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) { return a.score > b.score; });
+        for (size_t i = offset; i < hits.size() && merged.books.size() < limit; i++) {
+            merged.books.push_back(pages[hits[i].page].books[hits[i].position]);
+            merged.scores.push_back(hits[i].score);
+        }
+        return merged;
+    }
+
+    // Book search across every branch, in branch order
+    vector<Book> searchBooks(const string& query) const {
+        vector<Book> results;
+        for (auto& part : scatter([&](const Library& shard) { return shard.searchBooks(query); })) {
+            results.insert(results.end(), make_move_iterator(part.begin()), make_move_iterator(part.end()));
+        }
+        return results;
+    }
+
+    // Member search across every branch, in branch order
+    vector<Member> searchMembers(const string& query) const {
+        vector<Member> results;
+        for (auto& part : scatter([&](const Library& shard) { return shard.searchMembers(query); })) {
+            results.insert(results.end(), make_move_iterator(part.begin()), make_move_iterator(part.end()));
+        }
+        return results;
+    }
+
+    // Available books of every branch, gathered in parallel and listed in branch order
+    vector<Book> getAvailableBooks() const {
+        vector<Book> results;
+        for (auto& part : scatter([](const Library& shard) { return shard.getAvailableBooks(); })) {
+            results.insert(results.end(), make_move_iterator(part.begin()), make_move_iterator(part.end()));
+        }
+        return results;
+    }
+
+    // Borrowed books and their loans across every branch, in branch order
+    vector<pair<Book, Transaction>> getBorrowedBooksWithTransactions() const {
+        vector<pair<Book, Transaction>> results;
+        for (auto& part : scatter([](const Library& shard) { return shard.getBorrowedBooksWithTransactions(); })) {
+            results.insert(results.end(), make_move_iterator(part.begin()), make_move_iterator(part.end()));
+        }
+        return results;
+    }
+
+    // Members with overdue books across every branch with their fees, in branch order. A member
+    // belongs to one branch and borrows only there, so no member appears twice.
+    vector<pair<Member, double>> getOverdueMembers() const {
+        vector<pair<Member, double>> results;
+        for (auto& part : scatter([](const Library& shard) { return shard.getOverdueMembers(); })) {
+            results.insert(results.end(), make_move_iterator(part.begin()), make_move_iterator(part.end()));
+        }
+        return results;
+    }
+};
+
+// Where a library stands in log shipping: a primary reports its last journal record, a replica how
+// far it trails the primary's journal
+struct ReplicationStatus {
+    bool replica = false;
+    unsigned long long lsn = 0;    // last journal record written (primary) or applied (replica)
+    size_t lagRecords = 0;         // records read from the journal but not applied yet
+    uint64_t lagBytes = 0;         // journal bytes not read yet
+    double lagMs = 0;              // how long the replica has been behind; 0 once it has caught up
+    double delayMs = 0;            // from the journal write to its apply, for the latest batch
+    uint64_t appliedRecords = 0;   // records applied since the replica started
+    string error;                  // why replication stopped, if it did
+};
+
+#ifndef _WIN32
+
+// JournalFollower class to run a read replica of a journal-mode primary on the same machine. The
+// primary's journal is the shipped log: the follower opens the live and rotated journal files before
+// loading the data files, so a checkpoint retiring a rotated log cannot take records away from it,
+// then tails the live log on a background thread and applies each record as journal replay would.
+// When the primary rotates the log, the old file is drained before the new one is opened.
+class JournalFollower {
+private:
+    string dataDir;
+    chrono::milliseconds interval;
+    deque<int> backlog;  // rotated journals still to read, oldest first
+    int live = -1;       // the file that was journal.log when it was opened
+    string pending;      // bytes of a record the primary has not finished writing
+    unique_ptr<Library> replica;
+
+    mutable mutex statusMutex;
+    ReplicationStatus current;
+    chrono::steady_clock::time_point behindSince;
+    bool behind = false;
+
+    thread worker;
+    atomic<bool> stopping{false};
+
+    static constexpr size_t APPLY_BATCH = 1024;  // records applied per write lock, so readers get turns
+
+    string journalPath() const {
+        return dataPath(dataDir, "journal.log");
+    }
+
+    static int openFile(const string& path) {
+        return ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    void closeFiles() {
+        for (int fd : backlog) {
+            ::close(fd);
+        }
+        backlog.clear();
+        if (live >= 0) {
+            ::close(live);
+            live = -1;
+        }
+    }
+
+    // Rotated journals ending after lsn, oldest first
+    vector<string> rotatedAfter(unsigned long long lsn) const {
+        vector<pair<unsigned long long, string>> found;
+        string prefix = "journal.log.";
+        for (const auto& entry : filesystem::directory_iterator(dataDir.empty() ? "." : dataDir)) {
+            string name = entry.path().filename().string();
+            unsigned long long end = 0;
+            const char* last = name.data() + name.size();
+            if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+                from_chars(name.data() + prefix.size(), last, end).ptr == last && end > lsn) {
+                found.emplace_back(end, entry.path().string());
+            }
+        }
+        sort(found.begin(), found.end());
+        vector<string> paths;
+        for (const auto& file : found) {
+            paths.push_back(file.second);
+        }
+        return paths;
+    }
+
+    unsigned long long checkpointLsn() const {
+        unsigned long long lsn = 0;
+        ifstream checkpoint(dataPath(dataDir, "checkpoint.txt"));
+        checkpoint >> lsn;
+        return lsn;
+    }
+
+    // Open every journal file that can hold records after the current checkpoint. A rotation while
+    // the files are being opened shows up as a new rotated file, and the files are opened again.
+    void openJournals() {
+        for (int attempt = 0;; attempt++) {
+            closeFiles();
+            vector<string> rotated = rotatedAfter(checkpointLsn());
+            bool complete = true;
+            for (const auto& path : rotated) {
+                int fd = openFile(path);
+                if (fd < 0) {
+                    complete = false;  // retired by a checkpoint in the meantime
+                    break;
+                }
+                backlog.push_back(fd);
+            }
+            if (!complete) {
+                continue;
+            }
+            live = openFile(journalPath());
+            vector<string> again = rotatedAfter(checkpointLsn());
+            bool unchanged = all_of(again.begin(), again.end(), [&rotated](const string& path) {
+                return find(rotated.begin(), rotated.end(), path) != rotated.end();
+            });
+            if (live >= 0 && unchanged) {
+                return;
+            }
+            if (live < 0 && attempt * interval >= chrono::seconds(1)) {
+                throw runtime_error("No journal in " + (dataDir.empty() ? string(".") : dataDir) +
+                                    "; the primary must run in journal mode.");
+            }
+            this_thread::sleep_for(interval);
+        }
+    }
+
+    // Last write time of checkpoint.txt, waiting while a checkpoint is still publishing its data
+    // files (checkpoint.txt names them until they are all in place) or has published newer ones
+    filesystem::file_time_type settledCheckpoint() const {
+        while (true) {
+            error_code error;
+            auto checkpoint = filesystem::last_write_time(dataPath(dataDir, "checkpoint.txt"), error);
+            if (error) {
+                return filesystem::file_time_type::min();
+            }
+            ifstream contents(dataPath(dataDir, "checkpoint.txt"));
+            string line;
+            bool newer = getline(contents, line) && getline(contents, line);  // a pending data file
+            for (const char* name : {"books.txt", "members.txt", "transactions.txt", "library.bin"}) {
+                auto written = filesystem::last_write_time(dataPath(dataDir, name), error);
+                newer = newer || (!error && written > checkpoint);
+            }
+            if (!newer) {
+                return checkpoint;
+            }
+            this_thread::sleep_for(interval);
+        }
+    }
+
+    // Read fd to its end, applying every complete record; true if anything was applied
+    bool drain(int fd) {
+        bool applied = false;
+        char buffer[1 << 16];
+        while (true) {
+            ssize_t n = ::read(fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                throw runtime_error("Unable to read the primary's journal.");
+            }
+            if (n == 0) {
+                return applied;
+            }
+            pending.append(buffer, static_cast<size_t>(n));
+            applied = applyPending() || applied;
+        }
+    }
+
+    // Apply the complete records buffered so far and keep the torn tail for the next read
+    bool applyPending() {
+        vector<vector<string>> records;
+        CsvParser parser;
+        const char* start = pending.data();
+        const char* end = start + pending.size();
+        const char* p = start;
+        while (p < end) {
+            const char* next = parser.parse(p, end);
+            if (!parser.complete()) {
+                break;
+            }
+            p = next;
+            if (parser.empty()) {
+                continue;
+            }
+            vector<string> fields;
+            for (size_t i = 0; i < parser.size(); i++) {
+                fields.push_back(parser.str(i));
+            }
+            records.push_back(move(fields));
+        }
+        pending.erase(0, static_cast<size_t>(p - start));
+
+        for (size_t first = 0; first < records.size(); first += APPLY_BATCH) {
+            size_t last = min(records.size(), first + APPLY_BATCH);
+            {
+                lock_guard<mutex> lock(statusMutex);
+                current.lagRecords = records.size() - first;
+            }
+            replica->applyReplicatedRecords(vector<vector<string>>(make_move_iterator(records.begin() + first),
+                                                                   make_move_iterator(records.begin() + last)));
+            lock_guard<mutex> lock(statusMutex);
+            current.appliedRecords += last - first;
+            current.lagRecords = records.size() - last;
+        }
+        return !records.empty();
+    }
+
+    static uint64_t unread(int fd) {
+        struct stat info;
+        off_t position = lseek(fd, 0, SEEK_CUR);
+        return fstat(fd, &info) == 0 && position >= 0 && info.st_size > position
+                   ? static_cast<uint64_t>(info.st_size - position)
+                   : 0;
+    }
+
+    uint64_t unreadBytes() const {
+        uint64_t bytes = live >= 0 ? unread(live) : 0;
+        for (int fd : backlog) {
+            bytes += unread(fd);
+        }
+        return bytes;
+    }
+
+    // One pass over the journal: the rotated backlog, then the live log up to its current end
+    void poll() {
+        uint64_t waiting = unreadBytes();
+        {
+            lock_guard<mutex> lock(statusMutex);
+            current.lagBytes = waiting;
+            if (waiting > 0 && !behind) {
+                behind = true;
+                behindSince = chrono::steady_clock::now();
+            }
+        }
+        while (!backlog.empty()) {
+            drain(backlog.front());
+            ::close(backlog.front());
+            backlog.pop_front();
+            pending.clear();  // a rotated log ends on a complete record
+        }
+        if (live < 0) {
+            live = openFile(journalPath());
+            if (live < 0) {
+                return;  // between the primary's rename and the new log being created
+            }
+        }
+        bool applied = drain(live);
+
+        struct stat opened;
+        struct stat named;
+        if (fstat(live, &opened) != 0 || opened.st_size < lseek(live, 0, SEEK_CUR)) {
+            throw runtime_error("The primary's journal was truncated; the replica must be restarted.");
+        }
+        if (stat(journalPath().c_str(), &named) == 0 &&
+            (opened.st_ino != named.st_ino || opened.st_dev != named.st_dev)) {
+            // Rotated: the old file was closed before the rename, so this read finds its last records
+            drain(live);
+            ::close(live);
+            live = openFile(journalPath());
+            pending.clear();
+            if (live >= 0) {
+                applied = drain(live) || applied;
+            }
+        }
+
+        lock_guard<mutex> lock(statusMutex);
+        if (applied && live >= 0 && fstat(live, &opened) == 0) {
+            auto written = chrono::system_clock::time_point(chrono::duration_cast<chrono::system_clock::duration>(
+                chrono::seconds(opened.st_mtim.tv_sec) + chrono::nanoseconds(opened.st_mtim.tv_nsec)));
+            current.delayMs = max(0.0, chrono::duration<double, milli>(chrono::system_clock::now() - written).count());
+        }
+        current.lagBytes = unreadBytes();
+        behind = current.lagBytes > 0;
+    }
+
+    void run() {
+        while (!stopping) {
+            try {
+                poll();
+            } catch (const exception& e) {
+                lock_guard<mutex> lock(statusMutex);
+                current.error = e.what();
+                cerr << "Error: replication stopped: " << e.what() << endl;
+                return;
+            }
+            this_thread::sleep_for(interval);
+        }
+    }
+
+public:
+    // Open the primary's journal, load its data files as a replica and start following
+    JournalFollower(const LibraryOptions& opts, chrono::milliseconds pollInterval = chrono::milliseconds(5))
+        : dataDir(opts.dataDir), interval(pollInterval) {
+        LibraryOptions options = opts;
+        options.persistence = PersistenceMode::Replica;
+        options.threadSafe = true;
+        openJournals();
+        // Reload if a checkpoint replaced the data files while they were being read
+        while (true) {
+            auto checkpoint = settledCheckpoint();
+            replica.reset(new Library(options));
+            if (settledCheckpoint() == checkpoint) {
+                break;
+            }
+        }
+        current.replica = true;
+        worker = thread([this] { run(); });
+    }
+
+    ~JournalFollower() {
+        stopping = true;
+        if (worker.joinable()) {
+            worker.join();
+        }
+        closeFiles();
+    }
+
+    JournalFollower(const JournalFollower&) = delete;
+    JournalFollower& operator=(const JournalFollower&) = delete;
+
+    // The replica, for read-only queries while it follows the primary
+    Library& library() {
+        return *replica;
+    }
+
+    ReplicationStatus status() const {
+        ReplicationStatus snapshot;
+        {
+            lock_guard<mutex> lock(statusMutex);
+            snapshot = current;
+            if (behind) {
+                snapshot.lagMs = chrono::duration<double, milli>(chrono::steady_clock::now() - behindSince).count();
+            }
+        }
+        snapshot.lsn = replica->getLastLsn();
+        return snapshot;
+    }
+};
+
+#endif
+
+// CommandProcessor class to execute line-oriented CSV commands against a Library
+//
+// Each request is one CSV line: VERB,arg,... Responses are "OK", "OK,<value>", "ERR,<message>",
+// or "ROWS,<count>[,<next>]" followed by <count> CSV record lines. List commands take optional
+// offset,limit arguments; <next> is the offset of the following page and is present only when
+// more records remain.
+class CommandProcessor {
+private:
+    Library& library;
+    function<ReplicationStatus()> replicationStatus;  // set when the library is a replica
+
+    static void require(const CsvParser& request, size_t fields, const char* usage) {
+        if (request.size() < fields) {
+            throw runtime_error(string("Usage: ") + usage);
+        }
+    }
+
+    template <typename T>
+    static void writeRecords(string& out, const vector<T>& records) {
+        out += "ROWS," + to_string(records.size()) + '\n';
+        for (const auto& record : records) {
+            out += record.toString();
+            out += '\n';
+        }
+    }
+
+    static void writePage(string& out, const string& rows, const PageCursor& cursor) {
+        out += "ROWS," + to_string(cursor.visited);
+        if (cursor.more) {
+            out += "," + to_string(cursor.next);
+        }
+        out += '\n';
+        out += rows;
+    }
+
+    // Visitor that appends each record as a CSV line
+    static auto appendRecord(string& rows) {
+        return [&rows](const auto& record) {
+            rows += record.toString();
+            rows += '\n';
+        };
+    }
+
+    static size_t offsetArg(const CsvParser& r, size_t i) {
+        return r.size() > i ? static_cast<size_t>(r.integer(i)) : 0;
+    }
+
+    static size_t limitArg(const CsvParser& r, size_t i) {
+        return r.size() > i && !r[i].empty() ? static_cast<size_t>(r.integer(i)) : SIZE_MAX;
+    }
+
+    static void writeRows(string& out, const vector<string>& rows) {
+        out += "ROWS," + to_string(rows.size()) + '\n';
+        for (const auto& row : rows) {
+            out += row;
+            out += '\n';
+        }
+    }
+
+    static string upper(string_view text) {
+        string result(text);
+        for (auto& c : result) {
+            c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+        }
+        return result;
+    }
+
+public:
+    explicit CommandProcessor(Library& lib, function<ReplicationStatus()> replication = nullptr)
+        : library(lib), replicationStatus(move(replication)) {}
+
+    // Execute one request and append its response to out
+    void execute(const CsvParser& request, string& out) {
+        try {
+            dispatch(request, out);
+        } catch (const exception& e) {
+            out += "ERR," + csvField(e.what()) + '\n';
+        }
+    }
+
+    void dispatch(const CsvParser& r, string& out) {
+        string verb = upper(r[0]);
+        if (verb == "PING") {
+            out += "OK,PONG\n";
+        } else if (verb == "ADD_BOOK") {
+            require(r, 5, "ADD_BOOK,id,title,author,genre");
+            library.addBook(Book(r.str(1), r.str(2), r.str(3), r.str(4)));
+            out += "OK\n";
+        } else if (verb == "EDIT_BOOK") {
+            require(r, 5, "EDIT_BOOK,id,title,author,genre");
+            library.editBook(r.str(1), Book(r.str(1), r.str(2), r.str(3), r.str(4)));
+            out += "OK\n";
+        } else if (verb == "DELETE_BOOK") {
+            require(r, 2, "DELETE_BOOK,id");
+            library.deleteBook(r.str(1));
+            out += "OK\n";
+        } else if (verb == "BOOKS") {
+            string rows;
+            writePage(out, rows, library.visitBooks(appendRecord(rows), offsetArg(r, 1), limitArg(r, 2)));
+        } else if (verb == "ADD_MEMBER") {
+            require(r, 5, "ADD_MEMBER,id,name,address,phone");
+            library.addMember(Member(r.str(1), r.str(2), r.str(3), r.str(4)));
+            out += "OK\n";
+        } else if (verb == "EDIT_MEMBER") {
+            require(r, 5, "EDIT_MEMBER,id,name,address,phone");
+            library.editMember(r.str(1), Member(r.str(1), r.str(2), r.str(3), r.str(4)));
+            out += "OK\n";
+        } else if (verb == "DELETE_MEMBER") {
+            require(r, 2, "DELETE_MEMBER,id");
+            library.deleteMember(r.str(1));
+            out += "OK\n";
+        } else if (verb == "MEMBERS") {
+            string rows;
+            writePage(out, rows, library.visitMembers(appendRecord(rows), offsetArg(r, 1), limitArg(r, 2)));
+        } else if (verb == "BORROW") {
+            require(r, 3, "BORROW,memberID,bookID");
+            out += "OK," + csvField(library.borrowBook(r.str(1), r.str(2))) + '\n';
+        } else if (verb == "BORROW_BATCH") {
+            require(r, 3, "BORROW_BATCH,memberID,bookID[,bookID...]");
+            vector<string> bookIDs;
+            for (size_t i = 2; i < r.size(); i++) {
+                bookIDs.push_back(r.str(i));
+            }
+            string ids;
+            for (const auto& id : library.borrowBooks(r.str(1), bookIDs)) {
+                ids += "," + csvField(id);
+            }
+            out += "OK" + ids + '\n';
+        } else if (verb == "RETURN_BATCH") {
+            require(r, 2, "RETURN_BATCH,bookID[,bookID...]");
+            vector<string> identifiers;
+            for (size_t i = 1; i < r.size(); i++) {
+                identifiers.push_back(r.str(i));
+            }
+            library.returnBooks(identifiers);
+            out += "OK\n";
+        } else if (verb == "RETURN") {
+            require(r, 2, "RETURN,bookID or title");
+            library.returnBook(r.str(1));
+            out += "OK\n";
+        } else if (verb == "SEARCH_BOOKS") {
+            require(r, 2, "SEARCH_BOOKS,query[,offset,limit]");
+            size_t offset = r.size() > 2 ? static_cast<size_t>(r.integer(2)) : 0;
+            size_t limit = r.size() > 3 ? static_cast<size_t>(r.integer(3)) : 20;
+            writeRecords(out, library.searchCatalog(r.str(1), offset, limit).books);
+        } else if (verb == "SEARCH_MEMBERS") {
+            require(r, 2, "SEARCH_MEMBERS,query[,offset,limit]");
+            string rows;
+            writePage(out, rows,
+                      library.visitMemberMatches(r.str(1), appendRecord(rows), offsetArg(r, 2), limitArg(r, 3)));
+        } else if (verb == "HISTORY") {
+            require(r, 2, "HISTORY,memberID[,from,to]");
+            if (r.size() > 3) {
+                string rows;
+                size_t count = 0;
+                library.visitMemberHistory(r.str(1), parseDate(r.str(2)), parseDate(r.str(3)),
+                                           [&rows, &count](const TransactionRef& t) {
+                                               rows += t.toString();
+                                               rows += '\n';
+                                               count++;
+                                           });
+                out += "ROWS," + to_string(count) + '\n' + rows;
+            } else {
+                writeRecords(out, library.getMemberHistory(r.str(1)));
+            }
+        } else if (verb == "LOANS" || verb == "DUE") {
+            // Loans borrowed (LOANS) or expected back (DUE) in [from, to), earliest first
+            require(r, 3, "LOANS|DUE,from,to[,offset,limit]");
+            string rows;
+            time_t from = parseDate(r.str(1));
+            time_t to = parseDate(r.str(2));
+            writePage(out, rows,
+                      verb == "LOANS" ? library.visitLoansBorrowed(from, to, appendRecord(rows), offsetArg(r, 3),
+                                                                   limitArg(r, 4))
+                                      : library.visitLoansDue(from, to, appendRecord(rows), offsetArg(r, 3),
+                                                              limitArg(r, 4)));
+        } else if (verb == "STATS") {
+            // One row per figure: section,key,value
+            CirculationReport report = library.getCirculationReport(r.size() > 1 ? r.integer(1) : 10);
+            vector<string> rows;
+            auto section = [&rows](const char* name, const vector<pair<string, uint64_t>>& entries) {
+                for (const auto& entry : entries) {
+                    rows.push_back(string(name) + "," + csvField(entry.first) + "," + to_string(entry.second));
+                }
+            };
+            section("genre", report.loansByGenre);
+            section("author", report.topAuthors);
+            section("title", report.topTitles);
+            section("member", report.topMembers);
+            section("month", report.loansByMonth);
+            stringstream totals;
+            totals << fixed << setprecision(2) << "total,loans," << report.totalLoans << "\ntotal,open," << report.openLoans
+                   << "\ntotal,average_days," << report.averageLoanDays << "\ntotal,fees_charged,"
+                   << report.feesCharged << "\ntotal,fees_outstanding," << report.feesOutstanding;
+            string line;
+            while (getline(totals, line)) {
+                rows.push_back(line);
+            }
+            writeRows(out, rows);
+        } else if (verb == "METRICS") {
+            // METRICS[,json]: the text table one row per line, or a single JSON object
+            bool json = r.size() > 1 && upper(r[1]) == "JSON";
+            vector<string> rows;
+            stringstream report(metricsReport(json));
+            string line;
+            while (getline(report, line)) {
+                rows.push_back(line);
+            }
+            writeRows(out, rows);
+        } else if (verb == "REPLICA") {
+            // Replication position as key,value rows: a primary's last journal record, or a replica's lag
+            ReplicationStatus status;
+            if (replicationStatus) {
+                status = replicationStatus();
+            } else {
+                status.lsn = library.getLastLsn();
+            }
+            vector<string> rows = {string("role,") + (status.replica ? "replica" : "primary"),
+                                   "lsn," + to_string(status.lsn)};
+            if (status.replica) {
+                stringstream lag;
+                lag << fixed << setprecision(1) << "lag_ms," << status.lagMs << "\ndelay_ms," << status.delayMs;
+                string line;
+                while (getline(lag, line)) {
+                    rows.push_back(line);
+                }
+                rows.push_back("lag_records," + to_string(status.lagRecords));
+                rows.push_back("lag_bytes," + to_string(status.lagBytes));
+                rows.push_back("applied," + to_string(status.appliedRecords));
+                if (!status.error.empty()) {
+                    rows.push_back("error," + csvField(status.error));
+                }
+            }
+            writeRows(out, rows);
+        } else if (verb == "AVAILABLE") {
+            string rows;
+            writePage(out, rows, library.visitAvailableBooks(appendRecord(rows), offsetArg(r, 1), limitArg(r, 2)));
+        } else if (verb == "BORROWED") {
+            string rows;
+            time_t now = library.currentTime();
+            auto visit = [&rows, now](const Book& book, const TransactionRef& t) {
+                stringstream row;
+                row << csvField(book.getBookID()) << ',' << csvField(book.getTitle()) << ','
+                    << csvField(string(t.getMemberID())) << ',' << csvField(t.getTransactionID()) << ','
+                    << t.getFormattedBorrowDate() << ',' << t.getFormattedExpectedReturnDate() << ','
+                    << t.calculateOverdueDays(now) << ',' << fixed << setprecision(2) << t.calculateOverdueFees(now);
+                rows += row.str();
+                rows += '\n';
+            };
+            writePage(out, rows, library.visitBorrowedBooks(visit, offsetArg(r, 1), limitArg(r, 2)));
+        } else if (verb == "OVERDUE") {
+            vector<string> rows;
+            for (const auto& overdue : library.getOverdueMembers()) {
+                stringstream row;
+                row << overdue.first.toString() << ',' << fixed << setprecision(2) << overdue.second;
+                rows.push_back(row.str());
+            }
+            writeRows(out, rows);
+        } else if (verb == "ASOF") {
+            // ASOF[,date[,offset,limit]]: the loans out at date (now when omitted), read from one snapshot
+            auto snapshot = library.openSnapshot(r.size() > 1 && !r[1].empty() ? parseDate(r.str(1)) : 0);
+            time_t at = snapshot->getTime();
+            string rows;
+            auto visit = [&rows, at](const Book& book, const Transaction& t) {
+                stringstream row;
+                row << csvField(book.getBookID()) << ',' << csvField(book.getTitle()) << ','
+                    << csvField(t.getMemberID()) << ',' << csvField(t.getTransactionID()) << ','
+                    << t.getFormattedBorrowDate() << ',' << t.getFormattedExpectedReturnDate() << ','
+                    << t.calculateOverdueDays(at) << ',' << fixed << setprecision(2) << t.calculateOverdueFees(at);
+                rows += row.str();
+                rows += '\n';
+            };
+            writePage(out, rows, snapshot->visitOpenLoans(visit, offsetArg(r, 2), limitArg(r, 3)));
+        } else if (verb == "OWED") {
+            // OWED[,date]: members owing overdue fees at date (now when omitted), largest first
+            auto snapshot = library.openSnapshot(r.size() > 1 && !r[1].empty() ? parseDate(r.str(1)) : 0);
+            vector<string> rows;
+            for (const auto& owed : snapshot->getFeesOwed()) {
+                stringstream row;
+                row << owed.first.toString() << ',' << fixed << setprecision(2) << owed.second;
+                rows.push_back(row.str());
+            }
+            writeRows(out, rows);
+        } else {
+            throw runtime_error("Unknown command " + string(r[0]) + ".");
+        }
+    }
+};
+
+// Append text as a JSON string literal
+void appendJsonString(string& out, string_view text) {
+    out += '"';
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+// Rewrite one CommandProcessor response as a JSON line: {"ok":true,"values":[...]},
+// {"ok":true,"rows":[[...],...],"next":n} or {"ok":false,"error":"..."}
+void appendJsonResponse(string& out, const string& response) {
+    const char* p = response.data();
+    const char* end = p + response.size();
+    CsvParser line;
+    p = line.parse(p, end);
+    string status = line.empty() ? string() : line.str(0);
+    if (status == "ERR") {
+        out += "{\"ok\":false,\"error\":";
+        appendJsonString(out, line.size() > 1 ? line[1] : string_view());
+        out += "}\n";
+        return;
+    }
+    out += "{\"ok\":true";
+    if (status == "ROWS") {
+        size_t rows = line.size() > 1 ? static_cast<size_t>(line.integer(1)) : 0;
+        bool more = line.size() > 2;
+        string next = more ? line.str(2) : string();
+        out += ",\"rows\":[";
+        for (size_t row = 0; row < rows && p < end; row++) {
+            p = line.parse(p, end);
+            out += row ? ",[" : "[";
+            for (size_t i = 0; i < line.size(); i++) {
+                if (i) {
+                    out += ',';
+                }
+                appendJsonString(out, line[i]);
+            }
+            out += ']';
+        }
+        out += ']';
+        if (more) {
+            out += ",\"next\":" + next;
+        }
+    } else if (line.size() > 1) {
+        out += ",\"values\":[";
+        for (size_t i = 1; i < line.size(); i++) {
+            if (i > 1) {
+                out += ',';
+            }
+            appendJsonString(out, line[i]);
+        }
+        out += ']';
+    }
+    out += "}\n";
+}
+
+// Outcome of running a command script
+struct ScriptReport {
+    size_t commands = 0;
+    size_t failed = 0;
+    double seconds = 0;
+};
+
+// Run the server's line-oriented commands from in without prompts, one response per command in
+// the server's CSV framing or as JSON lines. Blank lines and lines starting with # are skipped.
+// Input is read and output written in large blocks rather than a line at a time.
+ScriptReport runScript(Library& library, FILE* in, FILE* out, bool json) {
+    const size_t BLOCK = 1 << 20;
+    auto start = chrono::steady_clock::now();
+    ScriptReport report;
+    CommandProcessor processor(library);
+    CsvParser request;
+    string input;
+    string output;
+    string response;
+    vector<char> buffer(BLOCK);
+    bool done = false;
+    while (!done) {
+        size_t n = fread(buffer.data(), 1, buffer.size(), in);
+        if (n == 0) {
+            done = true;
+            if (input.empty() || input.back() != '\n') {
+                input += '\n';  // the last command need not end with a line break
+            }
+        }
+        input.append(buffer.data(), n);
+
+        const char* first = input.data();
+        const char* end = first + input.size();
+        const char* p = first;
+        while (const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p))) {
+            request.parse(p, lineEnd + 1);
+            p = lineEnd + 1;
+            if (request.empty() || request[0].substr(0, 1) == "#") {
+                continue;
+            }
+            report.commands++;
+            response.clear();
+            processor.execute(request, response);
+            report.failed += response.compare(0, 4, "ERR,") == 0;
+            if (json) {
+                appendJsonResponse(output, response);
+            } else {
+                output += response;
+            }
+            if (output.size() >= BLOCK) {
+                fwrite(output.data(), 1, output.size(), out);
+                output.clear();
+            }
+        }
+        input.erase(0, static_cast<size_t>(p - first));
+    }
+    fwrite(output.data(), 1, output.size(), out);
+    fflush(out);
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+#ifdef __linux__
+
+// Parse "unix:PATH" or "tcp:PORT" (localhost only); a bare path means a Unix socket
+struct SocketAddress {
+    bool tcp = false;
+    string path;
+    int port = 0;
+
+    static SocketAddress parse(const string& text) {
+        SocketAddress address;
+        if (text.compare(0, 4, "tcp:") == 0) {
+            address.tcp = true;
+            address.port = stoi(text.substr(4));
+        } else {
+            address.path = text.compare(0, 5, "unix:") == 0 ? text.substr(5) : text;
+        }
+        return address;
+    }
+
+    // Open a listening or connected socket for this address
+    int open(bool listening) const {
+        int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            throw runtime_error(string("Unable to create socket: ") + strerror(errno));
+        }
+        sockaddr_storage storage = {};
+        socklen_t length;
+        if (tcp) {
+            auto* in = reinterpret_cast<sockaddr_in*>(&storage);
+            in->sin_family = AF_INET;
+            in->sin_port = htons(static_cast<uint16_t>(port));
+            in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            length = sizeof(sockaddr_in);
+            int on = 1;
+            setsockopt(fd, listening ? SOL_SOCKET : IPPROTO_TCP, listening ? SO_REUSEADDR : TCP_NODELAY, &on,
+                       sizeof(on));
+        } else {
+            auto* un = reinterpret_cast<sockaddr_un*>(&storage);
+            un->sun_family = AF_UNIX;
+            if (path.size() >= sizeof(un->sun_path)) {
+                ::close(fd);
+                throw runtime_error("Socket path too long: " + path);
+            }
+            strcpy(un->sun_path, path.c_str());
+            length = sizeof(sockaddr_un);
+            if (listening) {
+                unlink(path.c_str());
+            }
+        }
+        auto* raw = reinterpret_cast<sockaddr*>(&storage);
+        int result = listening ? ::bind(fd, raw, length) : ::connect(fd, raw, length);
+        if (result != 0 || (listening && ::listen(fd, SOMAXCONN) != 0)) {
+            string reason = strerror(errno);
+            ::close(fd);
+            throw runtime_error("Unable to " + string(listening ? "listen on " : "connect to ") + describe() + ": " +
+                                reason);
+        }
+        return fd;
+    }
+
+    string describe() const {
+        return tcp ? "tcp:127.0.0.1:" + to_string(port) : "unix:" + path;
+    }
+};
+
+// Write a whole buffer to a socket, waiting for room if it is non-blocking.
+// Gives up if the peer stops reading for 30 seconds.
+void sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += static_cast<size_t>(n);
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pollfd waiting = {fd, POLLOUT, 0};
+            if (poll(&waiting, 1, 30000) == 0) {
+                throw runtime_error("Peer stopped reading.");
+            }
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            throw runtime_error(string("Unable to send: ") + strerror(errno));
+        }
+    }
+}
+
+// LibraryServer class to serve one Library over a socket with an epoll loop and a worker pool
+class LibraryServer {
+private:
+    struct Connection {
+        int fd;
+        string input;
+    };
+
+    Library& library;
+    function<ReplicationStatus()> replicationStatus;
+    SocketAddress address;
+    int listenFd;
+    int epollFd;
+    mutex connectionsMutex;
+    unordered_map<int, shared_ptr<Connection>> connections;
+    ThreadPool pool;
+
+    static constexpr size_t MAX_REQUEST_BYTES = 1 << 20;  // longest request line a client may send
+
+    void watch(int fd, bool add) {
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event);
+    }
+
+    void acceptClients() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            if (address.tcp) {
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+            {
+                lock_guard<mutex> lock(connectionsMutex);
+                connections[fd] = make_shared<Connection>(Connection{fd, string()});
+            }
+            watch(fd, true);
+        }
+    }
+
+    void closeConnection(int fd) {
+        {
+            lock_guard<mutex> lock(connectionsMutex);
+            connections.erase(fd);
+        }
+        ::close(fd);
+    }
+
+    // Answer the complete requests buffered on a connection and keep any partial line
+    void answer(Connection& connection, CommandProcessor& processor, string& output) {
+        CsvParser request;
+        const char* start = connection.input.data();
+        const char* end = start + connection.input.size();
+        const char* p = start;
+        while (const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p))) {
+            request.parse(p, lineEnd + 1);
+            if (!request.empty()) {
+                processor.execute(request, output);
+            }
+            p = lineEnd + 1;
+        }
+        connection.input.erase(0, static_cast<size_t>(p - start));
+    }
+
+    // Read what has arrived, answer every complete request, then re-arm the connection. Requests
+    // are answered as each chunk arrives, so only a partial line is ever buffered; a client whose
+    // line grows past MAX_REQUEST_BYTES gets an error and is disconnected.
+    // EPOLLONESHOT guarantees only one worker services a connection at a time.
+    void service(shared_ptr<Connection> connection) {
+        bool open = true;
+        char buffer[65536];
+        CommandProcessor processor(library, replicationStatus);
+        string output;
+        try {
+            while (true) {
+                ssize_t n = ::recv(connection->fd, buffer, sizeof(buffer), 0);
+                if (n > 0) {
+                    connection->input.append(buffer, static_cast<size_t>(n));
+                    answer(*connection, processor, output);
+                    if (connection->input.size() > MAX_REQUEST_BYTES) {
+                        output += "ERR,Request exceeds " + to_string(MAX_REQUEST_BYTES) + " bytes.\n";
+                        open = false;
+                        break;
+                    }
+                    if (output.size() >= MAX_REQUEST_BYTES) {
+                        sendAll(connection->fd, output);
+                        output.clear();
+                    }
+                } else if (n < 0 && errno == EINTR) {
+                    continue;
+                } else {
+                    open = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+                    break;
+                }
+            }
+            sendAll(connection->fd, output);
+        } catch (const exception&) {
+            open = false;
+        }
+        if (open) {
+            watch(connection->fd, false);
+        } else {
+            closeConnection(connection->fd);
+        }
+    }
+
+public:
+    LibraryServer(Library& lib, const string& addressText, size_t workers,
+                  function<ReplicationStatus()> replication = nullptr)
+        : library(lib), replicationStatus(move(replication)), address(SocketAddress::parse(addressText)),
+          listenFd(address.open(true)), epollFd(epoll_create1(EPOLL_CLOEXEC)), pool(workers) {
+        fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = listenFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    }
+
+    ~LibraryServer() {
+        pool.shutdown();
+        for (const auto& connection : connections) {
+            ::close(connection.first);
+        }
+        ::close(epollFd);
+        ::close(listenFd);
+        if (!address.tcp) {
+            unlink(address.path.c_str());
+        }
+    }
+
+    LibraryServer(const LibraryServer&) = delete;
+    LibraryServer& operator=(const LibraryServer&) = delete;
+
+    string describe() const { return address.describe(); }
+
+    // Dispatch socket events to the worker pool until stop becomes true
+    void run(const volatile sig_atomic_t& stop) {
+        epoll_event events[128];
+        while (!stop) {
+            int ready = epoll_wait(epollFd, events, 128, 200);
+            for (int i = 0; i < ready; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptClients();
+                    continue;
+                }
+                shared_ptr<Connection> connection;
+                {
+                    lock_guard<mutex> lock(connectionsMutex);
+                    auto it = connections.find(fd);
+                    if (it == connections.end()) {
+                        continue;
+                    }
+                    connection = it->second;
+                }
+                pool.submit([this, connection] { service(connection); });
+            }
+        }
+    }
+};
+
+volatile sig_atomic_t serverStopRequested = 0;
+
+// Serve the library until SIGINT or SIGTERM. A replica serves reads from a copy that follows the
+// journal of the primary running on the same data directory.
+void runServer(const LibraryOptions& source, const string& address, bool replica) {
+    LibraryOptions options = source;
+    options.threadSafe = true;
+    unique_ptr<JournalFollower> follower;
+    unique_ptr<Library> primary;
+    function<ReplicationStatus()> replication;
+    if (replica) {
+        follower.reset(new JournalFollower(options));
+        replication = [&follower] { return follower->status(); };
+    } else {
+        primary.reset(new Library(options));
+    }
+    Library& library = replica ? follower->library() : *primary;
+    size_t workers = max(2u, thread::hardware_concurrency());
+    LibraryServer server(library, address, workers, replication);
+    signal(SIGINT, [](int) { serverStopRequested = 1; });
+    signal(SIGTERM, [](int) { serverStopRequested = 1; });
+    cout << "Serving " << (replica ? "a replica " : "") << "on " << server.describe() << " with " << workers
+         << " workers. Press Ctrl+C to stop." << endl;
+    server.run(serverStopRequested);
+    cout << "Server stopped." << endl;
+}
+
+// LineReader class to read newline-terminated responses from a blocking socket
+class LineReader {
+private:
+    int fd;
+    string buffer;
+    size_t position = 0;
+
+public:
+    explicit LineReader(int socket) : fd(socket) {}
+
+    string readLine() {
+        while (true) {
+            size_t newline = buffer.find('\n', position);
+            if (newline != string::npos) {
+                string line = buffer.substr(position, newline - position);
+                position = newline + 1;
+                if (position > 65536) {
+                    buffer.erase(0, position);
+                    position = 0;
+                }
+                return line;
+            }
+            char chunk[65536];
+            ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                throw runtime_error("Connection closed by server.");
+            }
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+    }
+
+    // Read a full response and return its status line
+    string readResponse() {
+        string status = readLine();
+        if (status.compare(0, 5, "ROWS,") == 0) {
+            size_t rows = stoul(status.substr(5));
+            for (size_t i = 0; i < rows; i++) {
+                readLine();
+            }
+        }
+        return status;
+    }
+};
+
+// Drive a running server from several connections and report latency percentiles
+void runLoadGenerator(const string& addressText, size_t connectionCount, size_t seconds) {
+    SocketAddress address = SocketAddress::parse(addressText);
+    const size_t bookCount = 1000;
+    const size_t memberCount = 100;
+    {
+        // Seed a catalog for the workload; existing records are left as they are
+        int fd = address.open(false);
+        LineReader reader(fd);
+        for (size_t i = 0; i < bookCount; i++) {
+            sendAll(fd, "ADD_BOOK,LG-B" + to_string(i) + ",Load Test Title " + to_string(i) + ",Load Author " +
+                            to_string(i % 50) + ",Load Genre\n");
+            reader.readResponse();
+        }
+        for (size_t i = 0; i < memberCount; i++) {
+            sendAll(fd, "ADD_MEMBER,LG-M" + to_string(i) + ",Load Member " + to_string(i) + ",Test Street,0700000000\n");
+            reader.readResponse();
+        }
+        ::close(fd);
+    }
+
+    vector<vector<double>> latencies(connectionCount);
+    vector<thread> clients;
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(seconds);
+    for (size_t c = 0; c < connectionCount; c++) {
+        clients.emplace_back([&, c] {
+            int fd = address.open(false);
+            LineReader reader(fd);
+            mt19937_64 rng(c + 1);
+            while (chrono::steady_clock::now() < deadline) {
+                string bookID = "LG-B" + to_string(rng() % bookCount);
+                unsigned action = rng() % 10;
+                string request;
+                if (action < 6) {
+                    request = "SEARCH_BOOKS,title " + to_string(rng() % bookCount) + "\n";
+                } else if (action < 8) {
+                    request = "BORROW,LG-M" + to_string(rng() % memberCount) + "," + bookID + "\n";
+                } else {
+                    request = "RETURN," + bookID + "\n";
+                }
+                auto start = chrono::steady_clock::now();
+                sendAll(fd, request);
+                reader.readResponse();
+                latencies[c].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+            }
+            ::close(fd);
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    vector<double> all;
+    for (const auto& samples : latencies) {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    if (all.empty()) {
+        throw runtime_error("No requests completed.");
+    }
+    sort(all.begin(), all.end());
+    auto percentile = [&all](double p) { return all[min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+    cout << "connections " << connectionCount << ", requests " << all.size() << '\n'
+         << fixed << setprecision(0) << "throughput " << all.size() / static_cast<double>(seconds) << " ops/sec\n"
+         << setprecision(1) << "latency p50 " << percentile(0.50) << " us, p99 " << percentile(0.99) << " us, max "
+         << all.back() << " us\n";
+}
+
+#endif
+
+// Benchmark helpers ---------------------------------------------------------
+
+// Time a callable and return the elapsed wall-clock time in nanoseconds
+template <typename F>
+double timeNanoseconds(F&& work) {
+    auto start = chrono::steady_clock::now();
+    work();
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+// Resident set size of this process in bytes (0 where it cannot be read)
+size_t residentBytes() {
+#ifdef __linux__
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    if (statm >> pages >> resident) {
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return 0;
+}
+
+// Compare ID lookup latency through the hash index against a linear scan
+void runLookupBenchmark(const vector<size_t>& sizes) {
+    cout << setw(12) << "records" << setw(18) << "index ns/lookup" << setw(18) << "scan ns/lookup" << '\n';
+    for (size_t n : sizes) {
+        LibraryOptions options;
+        options.persistence = PersistenceMode::None;
+        Library library(options);
+        for (size_t i = 0; i < n; i++) {
+            string id = "B" + to_string(i);
+            library.addBook(Book(id, "Title " + id, "Author", "Genre"));
+        }
+        vector<Book> scanned = library.getAllBooks();
+
+        mt19937_64 rng(42);
+        uniform_int_distribution<size_t> pick(0, n - 1);
+        const size_t indexLookups = 1000000;
+        const size_t scanLookups = max<size_t>(1, min<size_t>(1000, 100000000 / n));
+        vector<string> keys;
+        for (size_t i = 0; i < indexLookups; i++) {
+            keys.push_back("B" + to_string(pick(rng)));
+        }
+
+        size_t found = 0;
+        double indexNs = timeNanoseconds([&] {
+            for (const auto& key : keys) {
+                found += library.findBook(key) != nullptr;
+            }
+        });
+        double scanNs = timeNanoseconds([&] {
+            for (size_t i = 0; i < scanLookups; i++) {
+                const string& key = keys[i];
+                auto it = find_if(scanned.begin(), scanned.end(),
+                                  [&key](const Book& b) { return b.getBookID() == key; });
+                found += it != scanned.end();
+            }
+        });
+        if (found != indexLookups + scanLookups) {
+            throw runtime_error("Lookup benchmark missed a record.");
+        }
+        cout << setw(12) << n << setw(18) << fixed << setprecision(1) << indexNs / indexLookups
+             << setw(18) << scanNs / scanLookups << '\n';
+    }
+}
+
+// Compare ranked index search with the original linear title scan
+void runSearchBenchmark(size_t bookCount) {
+    const char* syllables[] = {"an", "bel", "cor", "dra", "el", "fen", "gal", "hor", "is", "jun", "kal", "lor",
+                               "mar", "nor", "or", "pel", "quin", "ros", "sel", "tor", "ul", "ven", "wil", "yor"};
+    mt19937_64 rng(3);
+    uniform_int_distribution<int> pickSyllable(0, 23);
+    auto word = [&]() {
+        string w;
+        int length = 2 + static_cast<int>(rng() % 3);
+        for (int i = 0; i < length; i++) {
+            w += syllables[pickSyllable(rng)];
+        }
+        return w;
+    };
+    vector<string> vocabulary;
+    for (int i = 0; i < 20000; i++) {
+        vocabulary.push_back(word());
+    }
+    uniform_int_distribution<size_t> pickWord(0, vocabulary.size() - 1);
+
+    LibraryOptions options;
+    options.persistence = PersistenceMode::None;
+    Library library(options);
+    for (size_t i = 0; i < bookCount; i++) {
+        string title = vocabulary[pickWord(rng)] + " " + vocabulary[pickWord(rng)] + " " + vocabulary[pickWord(rng)];
+        library.addBook(Book("B" + to_string(i), title, vocabulary[pickWord(rng) % 3000], "Genre " + to_string(i % 40)));
+    }
+    vector<Book> catalog = library.getAllBooks();
+
+    const size_t queries = 200;
+    vector<string> terms;
+    for (size_t i = 0; i < queries; i++) {
+        string term = vocabulary[pickWord(rng)];
+        terms.push_back(i % 2 == 0 ? term : term.substr(0, 4));  // whole words and typed prefixes
+    }
+    size_t scanMatches = 0;
+    size_t indexMatches = 0;
+    double scanNs = timeNanoseconds([&] {
+        for (const auto& term : terms) {
+            for (const auto& book : catalog) {
+                scanMatches += book.getTitle().find(term) != string::npos;
+            }
+        }
+    });
+    double indexNs = timeNanoseconds([&] {
+        for (const auto& term : terms) {
+            indexMatches += library.searchCatalog(term, 0, 20).totalMatches;
+        }
+    });
+    cout << "books " << bookCount << ": linear scan " << fixed << setprecision(1) << scanNs / queries / 1000
+         << " us/query (" << scanMatches / queries << " avg matches), index " << indexNs / queries / 1000
+         << " us/query (" << indexMatches / queries << " avg matches)\n";
+}
+
+// Scatter-gather search and routed borrow/return latency with the catalog split over 1, 2, 4 and 8 branches
+void runShardedBenchmark(size_t bookCount) {
+    const size_t memberCount = max<size_t>(8, bookCount / 5);  // at least one member per branch
+    const size_t queries = 200;
+    cout << "books " << bookCount << '\n'
+         << setw(8) << "shards" << setw(12) << "build ms" << setw(14) << "search us" << setw(14) << "borrow us"
+         << setw(12) << "matches" << '\n';
+    for (size_t shardCount : {1, 2, 4, 8}) {
+        LibraryOptions options;
+        options.persistence = PersistenceMode::None;
+        vector<string> branches;
+        for (size_t s = 0; s < shardCount; s++) {
+            branches.push_back("branch" + to_string(s));
+        }
+        ShardedLibrary library(options, branches);
+        double buildNs = timeNanoseconds([&] {
+            for (size_t i = 0; i < bookCount; i++) {
+                string id = "B" + to_string(i);
+                library.addBook(branches[i % shardCount],
+                                Book(id, "Title " + id, "Author " + to_string(i % 5000), "Genre " + to_string(i % 40)));
+            }
+            for (size_t i = 0; i < memberCount; i++) {
+                string id = "M" + to_string(i);
+                library.addMember(branches[i % shardCount], Member(id, "Member " + id, "Library Road", "0700"));
+            }
+        });
+
+        mt19937_64 rng(5);
+        uniform_int_distribution<size_t> pickAuthor(0, 4999);
+        uniform_int_distribution<size_t> pickBook(0, bookCount - 1);
+        size_t matches = 0;
+        double searchNs = timeNanoseconds([&] {
+            for (size_t q = 0; q < queries; q++) {
+                matches += library.searchCatalog("Author " + to_string(pickAuthor(rng)), 0, 20).totalMatches;
+            }
+        });
+        // A member of the book's own branch borrows it and brings it back
+        double borrowNs = timeNanoseconds([&] {
+            for (size_t q = 0; q < queries; q++) {
+                size_t book = pickBook(rng);
+                size_t member = book % shardCount;
+                library.borrowBook("M" + to_string(member), "B" + to_string(book));
+                library.returnBook("B" + to_string(book));
+            }
+        });
+        cout << setw(8) << shardCount << setw(12) << fixed << setprecision(1) << buildNs / 1e6 << setw(14)
+             << searchNs / queries / 1e3 << setw(14) << borrowNs / queries / 1e3 << setw(12) << matches / queries
+             << '\n';
+    }
+}
+
+// Compare the contiguous substring scanner with calling string::find on each record
+void runScanBenchmark(size_t recordCount) {
+    const char* first[] = {"Amina", "Brian", "Cynthia", "David", "Esther", "Faith", "George", "Hassan",
+                           "Irene", "James", "Kevin", "Lucy", "Mercy", "Njeri", "Otieno", "Peter"};
+    const char* last[] = {"Achieng", "Barasa", "Chege", "Kamau", "Kiprop", "Mutua", "Njoroge", "Odhiambo",
+                          "Omondi", "Otieno", "Wafula", "Wanjiru", "Wekesa", "Kariuki", "Mwangi", "Ndungu"};
+    vector<string> names;
+    names.reserve(recordCount);
+    TextScanner scanner;
+    for (size_t i = 0; i < recordCount; i++) {
+        names.push_back(string(first[i % 16]) + " " + last[(i / 16) % 16] + " " + to_string(i));
+        scanner.append(names.back());
+        names.back() = SearchIndex::fold(names.back());  // the baseline searches pre-folded heap strings
+    }
+
+    const vector<string> queries = {"wanjiru 99", "kip", "zz", "mercy odhiambo 1"};
+    cout << "records " << recordCount << ", kernel " << TextScanner::kernelName() << '\n';
+    for (const auto& query : queries) {
+        size_t scanned = 0;
+        size_t perRecord = 0;
+        double scanMs = timeNanoseconds([&] { scanned = scanner.find(query).size(); }) / 1e6;
+        double perRecordMs = timeNanoseconds([&] {
+            for (const auto& name : names) {
+                perRecord += name.find(query) != string::npos;
+            }
+        }) / 1e6;
+        if (scanned != perRecord) {
+            throw runtime_error("Scan benchmark results disagree.");
+        }
+        cout << setw(20) << ("\"" + query + "\"") << setw(10) << scanned << " matches  scanner " << fixed
+             << setprecision(2) << setw(9) << scanMs << " ms  per-record find " << setw(9) << perRecordMs << " ms\n";
+    }
+}
+
+// Create an empty scratch directory for benchmark data files
+string makeScratchDirectory(const string& name) {
+    filesystem::path dir = filesystem::temp_directory_path() / (name + "-" + to_string(getpid()));
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+    return dir.string();
+}
+
+// Build an in-memory library with synthetic books, members and transactions
+void populateSyntheticLibrary(Library& library, size_t bookCount, size_t memberCount, size_t transactionCount) {
+    mt19937_64 rng(7);
+    for (size_t i = 0; i < bookCount; i++) {
+        string id = "B" + to_string(i);
+        library.addBook(Book(id, "Title " + id, "Author " + to_string(i % 5000), "Genre " + to_string(i % 40)));
+    }
+    for (size_t i = 0; i < memberCount; i++) {
+        string id = "M" + to_string(i);
+        library.addMember(Member(id, "Member " + id, to_string(i) + " Library Road", "07" + to_string(10000000 + i)));
+    }
+    uniform_int_distribution<size_t> pickBook(0, max<size_t>(bookCount, 1) - 1);
+    uniform_int_distribution<size_t> pickMember(0, max<size_t>(memberCount, 1) - 1);
+    for (size_t i = 0; i < transactionCount; i++) {
+        string bookID = "B" + to_string(pickBook(rng));
+        const Book* book = library.findBook(bookID);
+        if (!book->getAvailability()) {
+            library.returnBook(bookID);
+        }
+        library.borrowBook("M" + to_string(pickMember(rng)), bookID);
+    }
+}
+
+// Hammer borrow/return/search from several threads, then verify the loan invariants
+void runConcurrencyStressTest(const vector<size_t>& threadCounts) {
+    const size_t bookCount = 1000;
+    const size_t memberCount = 200;
+    const auto duration = chrono::seconds(2);
+    cout << setw(8) << "threads" << setw(14) << "ops/sec" << setw(12) << "borrows" << setw(12) << "returns" << '\n';
+    for (size_t threadCount : threadCounts) {
+        LibraryOptions options;
+        options.persistence = PersistenceMode::None;
+        options.threadSafe = true;
+        Library library(options);
+        populateSyntheticLibrary(library, bookCount, memberCount, 0);
+
+        atomic<size_t> operations(0);
+        atomic<size_t> borrows(0);
+        atomic<size_t> returns(0);
+        atomic<bool> stop(false);
+        vector<thread> desks;
+        for (size_t t = 0; t < threadCount; t++) {
+            desks.emplace_back([&, t] {
+                mt19937_64 rng(1000 + t);
+                size_t done = 0;
+                while (!stop.load(memory_order_relaxed)) {
+                    string bookID = "B" + to_string(rng() % bookCount);
+                    unsigned action = rng() % 10;
+                    try {
+                        if (action < 4) {
+                            library.borrowBook("M" + to_string(rng() % memberCount), bookID);
+                            borrows++;
+                        } else if (action < 8) {
+                            library.returnBook(bookID);
+                            returns++;
+                        } else {
+                            library.searchBooks("Title " + bookID);
+                        }
+                    } catch (const runtime_error&) {
+                        // Lost the race for this copy; the library refused the operation
+                    }
+                    done++;
+                }
+                operations += done;
+            });
+        }
+        this_thread::sleep_for(duration);
+        stop = true;
+        for (auto& desk : desks) {
+            desk.join();
+        }
+
+        library.checkInvariants();
+        if (library.getAllTransactions().size() != borrows ||
+            library.getBorrowedBooksWithTransactions().size() != borrows - returns) {
+            throw runtime_error("Loan counts do not match the successful borrows and returns.");
+        }
+        cout << setw(8) << threadCount << setw(14) << fixed << setprecision(0)
+             << operations / chrono::duration<double>(duration).count() << setw(12) << borrows.load() << setw(12)
+             << returns.load() << '\n';
+    }
+    cout << "Invariants held." << '\n';
+}
+
+// Compare batched checkout and return against one call per book, with every commit synced to disk
+void runBatchBenchmark(const vector<size_t>& batchSizes) {
+    const size_t memberCount = 100;
+    cout << setw(8) << "batch" << setw(18) << "single loans/sec" << setw(18) << "batch loans/sec" << setw(10)
+         << "speedup" << '\n';
+    for (size_t batchSize : batchSizes) {
+        size_t batches = max<size_t>(1, 2000 / batchSize);
+        size_t bookCount = batchSize * batches;
+        double rates[2];
+        for (int batched = 0; batched < 2; batched++) {
+            string dir = makeScratchDirectory("lms-bench-batch");
+            LibraryOptions options;
+            options.dataDir = dir;
+            options.persistence = PersistenceMode::Journal;
+            options.syncPolicy = SyncPolicy::PerOperation;
+            unique_ptr<Library> library(new Library(options));
+            for (size_t i = 0; i < bookCount; i++) {
+                string id = "B" + to_string(i);
+                library->addBook(Book(id, "Title " + id, "Author " + to_string(i % 500), "Genre " + to_string(i % 40)));
+            }
+            for (size_t i = 0; i < memberCount; i++) {
+                string id = "M" + to_string(i);
+                library->addMember(Member(id, "Member " + id, to_string(i) + " Library Road", "07" + to_string(i)));
+            }
+
+            double seconds = timeNanoseconds([&] {
+                for (size_t b = 0; b < batches; b++) {
+                    string memberID = "M" + to_string(b % memberCount);
+                    vector<string> bookIDs;
+                    for (size_t i = b * batchSize; i < (b + 1) * batchSize; i++) {
+                        bookIDs.push_back("B" + to_string(i));
+                    }
+                    if (batched) {
+                        library->borrowBooks(memberID, bookIDs);
+                        library->returnBooks(bookIDs);
+                    } else {
+                        for (const auto& bookID : bookIDs) {
+                            library->borrowBook(memberID, bookID);
+                        }
+                        for (const auto& bookID : bookIDs) {
+                            library->returnBook(bookID);
+                        }
+                    }
+                }
+            }) / 1e9;
+            if (library->getAllTransactions().size() != bookCount || !library->getBorrowedBooksWithTransactions().empty()) {
+                throw runtime_error("Batch benchmark recorded the wrong number of loans.");
+            }
+            rates[batched] = bookCount / seconds;
+            library.reset();  // checkpoint before the scratch directory goes away
+            filesystem::remove_all(dir);
+        }
+        cout << setw(8) << batchSize << setw(18) << fixed << setprecision(0) << rates[0] << setw(18) << rates[1]
+             << setw(9) << setprecision(1) << rates[1] / rates[0] << "x\n";
+    }
+}
+
+// Foreground latency of edits in snapshot mode: background snapshots compared with writing the
+// data files before each call returns
+void runSnapshotBenchmark(size_t bookCount) {
+    const size_t edits = 200;
+    cout << setw(12) << "mode" << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "max us" << '\n';
+    for (int synchronous = 0; synchronous < 2; synchronous++) {
+        string dir = makeScratchDirectory("lms-bench-snapshot");
+        {
+            ofstream books(dataPath(dir, "books.txt"));
+            for (size_t i = 0; i < bookCount; i++) {
+                string id = "B" + to_string(i);
+                books << Book(id, "Title " + id, "Author " + to_string(i % 500), "Genre " + to_string(i % 40)).toString()
+                      << '\n';
+            }
+        }
+        LibraryOptions options;
+        options.dataDir = dir;
+        options.persistence = PersistenceMode::Snapshot;
+        unique_ptr<Library> library(new Library(options));
+        vector<double> latencies;
+        for (size_t i = 0; i < edits; i++) {
+            string id = "B" + to_string(i * 7919 % bookCount);
+            latencies.push_back(timeNanoseconds([&] {
+                library->editBook(id, Book(id, "Edited " + to_string(i), "Author", "Genre"));
+                if (synchronous) {
+                    library->sync();
+                }
+            }) / 1e3);
+        }
+        library.reset();  // flush the last snapshot before the scratch directory goes away
+        filesystem::remove_all(dir);
+        sort(latencies.begin(), latencies.end());
+        cout << setw(12) << (synchronous ? "synchronous" : "background") << fixed << setprecision(1) << setw(12)
+             << latencies[edits / 2] << setw(12) << latencies[edits * 99 / 100] << setw(12) << latencies.back() << '\n';
+    }
+}
+
+// Compare the column store against a vector of Transaction objects: memory, build time and a report walk
+void runTransactionStoreBenchmark(size_t transactionCount) {
+    const size_t bookCount = max<size_t>(1, transactionCount / 5);
+    const size_t memberCount = max<size_t>(1, transactionCount / 10);
+    const time_t now = time(nullptr);
+    const time_t start = now - static_cast<time_t>(transactionCount) * 60;
+    mt19937_64 rng(13);
+    vector<pair<size_t, size_t>> picks(transactionCount);  // (member, book)
+    for (auto& pick : picks) {
+        pick = make_pair(rng() % memberCount, rng() % bookCount);
+    }
+    auto borrowedAt = [&](size_t i) { return start + static_cast<time_t>(i) * 60; };
+    auto returnedAt = [&](size_t i) { return i % 10 == 0 ? 0 : borrowedAt(i) + 7 * 24 * 60 * 60; };
+
+    cout << "transactions " << transactionCount << '\n' << setw(10) << "layout" << setw(14) << "MiB" << setw(14)
+         << "bytes/record" << setw(12) << "build ms" << setw(12) << "walk ms" << '\n';
+    auto report = [&](const char* layout, size_t bytes, double buildNs, double walkNs) {
+        cout << setw(10) << layout << setw(14) << fixed << setprecision(1) << bytes / 1048576.0 << setw(14)
+             << static_cast<double>(bytes) / transactionCount << setw(12) << buildNs / 1e6 << setw(12)
+             << walkNs / 1e6 << '\n';
+    };
+
+    double feesColumns = 0;
+    {
+        size_t before = residentBytes();
+        TransactionStore store;
+        double buildNs = timeNanoseconds([&] {
+            store.reserve(transactionCount);
+            for (size_t i = 0; i < transactionCount; i++) {
+                store.append(to_string(i + 1), "M" + to_string(picks[i].first), "B" + to_string(picks[i].second),
+                             borrowedAt(i), returnedAt(i), borrowedAt(i) + 14 * 24 * 60 * 60);
+            }
+        });
+        size_t bytes = max(residentBytes() - before, store.memoryUsage());
+        double walkNs = timeNanoseconds([&] {
+            for (size_t i = 0; i < store.size(); i++) {
+                if (store.returnDate(i) == 0 && store.expectedReturnDate(i) < now) {
+                    feesColumns += (now - store.expectedReturnDate(i)) / (24 * 60 * 60) * 100.0;
+                }
+            }
+        });
+        report("columns", bytes, buildNs, walkNs);
+    }
+    double feesObjects = 0;
+    {
+        size_t before = residentBytes();
+        vector<Transaction> objects;
+        double buildNs = timeNanoseconds([&] {
+            objects.reserve(transactionCount);
+            for (size_t i = 0; i < transactionCount; i++) {
+                objects.push_back(Transaction(to_string(i + 1), "M" + to_string(picks[i].first),
+                                              "B" + to_string(picks[i].second), borrowedAt(i), returnedAt(i),
+                                              borrowedAt(i) + 14 * 24 * 60 * 60));
+            }
+        });
+        size_t bytes = max(residentBytes() - before, objects.capacity() * sizeof(Transaction));
+        double walkNs = timeNanoseconds([&] {
+            for (const auto& transaction : objects) {
+                if (transaction.getReturnDate() == 0 && transaction.getExpectedReturnDate() < now) {
+                    feesObjects += transaction.calculateOverdueFees(now);
+                }
+            }
+        });
+        report("objects", bytes, buildNs, walkNs);
+    }
+    if (feesColumns != feesObjects) {
+        throw runtime_error("Column store and object walk disagree on overdue fees.");
+    }
+}
+
+// Time the parallel analytics rebuild and report queries against a per-record lookup scan
+void runAnalyticsBenchmark(size_t transactionCount) {
+    size_t bookCount = max<size_t>(1, transactionCount / 5);
+    size_t memberCount = max<size_t>(1, transactionCount / 10);
+    LibraryOptions options;
+    options.persistence = PersistenceMode::None;
+    Library library(options);
+    populateSyntheticLibrary(library, bookCount, memberCount, transactionCount);
+
+    // The way a report would be written without the aggregates: one findBook per loan
+    map<string, uint64_t> genres;
+    double scanMs = timeNanoseconds([&] {
+        for (const auto& transaction : library.getAllTransactions()) {
+            const Book* book = library.findBook(transaction.getBookID());
+            genres[book ? book->getGenre() : "(unknown)"]++;
+        }
+    }) / 1e6;
+    CirculationReport report;
+    double rebuildMs = timeNanoseconds([&] { report = library.getCirculationReport(); }) / 1e6;
+    const int queries = 1000;
+    double queryUs = timeNanoseconds([&] {
+        for (int i = 0; i < queries; i++) {
+            report = library.getCirculationReport();
+        }
+    }) / queries / 1e3;
+    if (report.totalLoans != transactionCount || report.loansByGenre.size() != genres.size()) {
+        throw runtime_error("Analytics disagree with the transaction scan.");
+    }
+    cout << "transactions " << transactionCount << ": lookup scan " << fixed << setprecision(1) << scanMs
+         << " ms, parallel rebuild " << rebuildMs << " ms on " << max(1u, thread::hardware_concurrency())
+         << " threads, report " << setprecision(1) << queryUs << " us\n";
+}
+
+// Compare date-bounded queries through the sorted date indexes against full scans of the loans
+void runDateRangeBenchmark(size_t transactionCount) {
+    size_t bookCount = max<size_t>(1, transactionCount / 5);
+    size_t memberCount = max<size_t>(1, transactionCount / 10);
+    LibraryOptions options;
+    options.persistence = PersistenceMode::None;
+    Library library(options);
+    const time_t start = time(nullptr) - static_cast<time_t>(transactionCount) * 120;
+    time_t now = start;
+    library.setClock([&now] { return now += 60; });  // loans a minute or two apart
+    populateSyntheticLibrary(library, bookCount, memberCount, transactionCount);
+
+    const time_t week = 7 * 24 * 60 * 60;
+    const int queries = 200;
+    mt19937_64 rng(3);
+    uniform_int_distribution<time_t> pickStart(start, max(start, now - week));
+    uniform_int_distribution<size_t> pickMember(0, memberCount - 1);
+    vector<time_t> starts;
+    vector<string> memberIDs;
+    for (int i = 0; i < queries; i++) {
+        starts.push_back(pickStart(rng));
+        memberIDs.push_back("M" + to_string(pickMember(rng)));
+    }
+    auto report = [](const char* query, double indexNs, double scanNs, size_t indexHits, size_t scanHits) {
+        if (indexHits != scanHits) {
+            throw runtime_error(string("Index and scan disagree on ") + query + ".");
+        }
+        cout << setw(22) << query << setw(14) << fixed << setprecision(1) << indexNs / queries / 1e3 << setw(14)
+             << scanNs / queries / 1e3 << setw(10) << setprecision(0) << scanNs / indexNs << "x" << setw(12)
+             << indexHits / queries << '\n';
+    };
+    cout << "transactions " << transactionCount << '\n'
+         << setw(22) << "query" << setw(14) << "index us" << setw(14) << "scan us" << setw(11) << "speedup" << setw(12)
+         << "rows/query" << '\n';
+
+    size_t indexHits = 0;
+    size_t scanHits = 0;
+    double indexNs = timeNanoseconds([&] {
+        for (time_t from : starts) {
+            indexHits += library.visitLoansBorrowed(from, from + week, [](const TransactionRef&) {}).visited;
+        }
+    });
+    double scanNs = timeNanoseconds([&] {
+        for (time_t from : starts) {
+            library.visitTransactions([&](const TransactionRef& t) {
+                scanHits += t.getBorrowDate() >= from && t.getBorrowDate() < from + week;
+            });
+        }
+    });
+    report("borrowed in a week", indexNs, scanNs, indexHits, scanHits);
+
+    indexHits = scanHits = 0;
+    indexNs = timeNanoseconds([&] {
+        for (time_t from : starts) {
+            indexHits += library.visitLoansDue(from, from + week, [](const TransactionRef&) {}).visited;
+        }
+    });
+    scanNs = timeNanoseconds([&] {
+        for (time_t from : starts) {
+            library.visitTransactions([&](const TransactionRef& t) {
+                scanHits += t.getExpectedReturnDate() >= from && t.getExpectedReturnDate() < from + week;
+            });
+        }
+    });
+    report("due in a week", indexNs, scanNs, indexHits, scanHits);
+
+    indexHits = scanHits = 0;
+    const time_t year = 365 * 24 * 60 * 60;
+    indexNs = timeNanoseconds([&] {
+        for (const auto& memberID : memberIDs) {
+            library.visitMemberHistory(memberID, now - year, now + 1, [&](const TransactionRef&) { indexHits++; });
+        }
+    });
+    scanNs = timeNanoseconds([&] {
+        for (const auto& memberID : memberIDs) {
+            library.visitTransactions([&](const TransactionRef& t) {
+                scanHits += t.getMemberID() == memberID && t.getBorrowDate() >= now - year && t.getBorrowDate() <= now;
+            });
+        }
+    });
+    report("member's last year", indexNs, scanNs, indexHits, scanHits);
+}
+
+// Compare startup time of the text data files against the memory-mapped binary catalog
+void runStartupBenchmark(size_t transactionCount) {
+    size_t bookCount = max<size_t>(1, transactionCount / 5);
+    size_t memberCount = max<size_t>(1, transactionCount / 10);
+    string textDir = makeScratchDirectory("lms-bench-text");
+    string binaryDir = makeScratchDirectory("lms-bench-binary");
+    {
+        LibraryOptions options;
+        options.persistence = PersistenceMode::None;
+        Library library(options);
+        populateSyntheticLibrary(library, bookCount, memberCount, transactionCount);
+        library.writeSnapshot(textDir, DataFormat::Text);
+        library.writeSnapshot(binaryDir, DataFormat::Binary);
+    }
+
+    cout << "books " << bookCount << ", members " << memberCount << ", transactions " << transactionCount << '\n';
+    for (DataFormat format : {DataFormat::Text, DataFormat::Binary}) {
+        LibraryOptions options;
+        options.persistence = PersistenceMode::ReadOnly;
+        options.format = format;
+        options.dataDir = format == DataFormat::Text ? textDir : binaryDir;
+        size_t bytes = 0;
+        for (const auto& entry : filesystem::directory_iterator(options.dataDir)) {
+            bytes += entry.file_size();
+        }
+        double ms = timeNanoseconds([&] { Library library(options); }) / 1e6;
+        cout << setw(8) << (format == DataFormat::Text ? "text" : "binary") << setw(12) << bytes / 1024 << " KiB"
+             << setw(12) << fixed << setprecision(1) << ms << " ms\n";
+    }
+    filesystem::remove_all(textDir);
+    filesystem::remove_all(binaryDir);
+}
+
+// Write synthetic text data files directly, without building a library in memory
+void writeSyntheticTextFiles(const string& dir, size_t bookCount, size_t memberCount, size_t transactionCount) {
+    mt19937_64 rng(11);
+    {
+        ofstream file(dataPath(dir, "books.txt"));
+        for (size_t i = 0; i < bookCount; i++) {
+            string id = "B" + to_string(i);
+            // Every tenth title contains a comma to exercise quoting
+            string title = i % 10 == 0 ? "Title " + id + ", Volume " + to_string(i % 7) : "Title " + id;
+            file << Book(id, title, "Author " + to_string(i % 5000), "Genre " + to_string(i % 40)).toString() << '\n';
+        }
+    }
+    {
+        ofstream file(dataPath(dir, "members.txt"));
+        for (size_t i = 0; i < memberCount; i++) {
+            string id = "M" + to_string(i);
+            file << Member(id, "Member " + id, to_string(i) + " Library Road", "07" + to_string(10000000 + i)).toString()
+                 << '\n';
+        }
+    }
+    {
+        ofstream file(dataPath(dir, "transactions.txt"));
+        uniform_int_distribution<size_t> pickBook(0, bookCount - 1);
+        uniform_int_distribution<size_t> pickMember(0, memberCount - 1);
+        time_t start = time(nullptr) - static_cast<time_t>(transactionCount) * 60;
+        for (size_t i = 0; i < transactionCount; i++) {
+            time_t borrowed = start + static_cast<time_t>(i) * 60;
+            file << Transaction(to_string(i + 1), "M" + to_string(pickMember(rng)), "B" + to_string(pickBook(rng)),
+                                borrowed, borrowed + 7 * 24 * 60 * 60, borrowed + 14 * 24 * 60 * 60).toString()
+                 << '\n';
+        }
+    }
+}
+
+// ZipfDistribution class to draw ranks 1..n with probability proportional to 1/rank^exponent in
+// constant time and memory (rejection-inversion sampling, Hörmann and Derflinger)
+class ZipfDistribution {
+private:
+    double exponent;
+    double n;
+    double hIntegralX1;
+    double hIntegralN;
+    double threshold;
+
+    // log1p(x) / x and expm1(x) / x, with series expansions near zero
+    static double log1pOverX(double x) {
+        return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+    }
+
+    static double expm1OverX(double x) {
+        return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+    }
+
+    double h(double x) const {
+        return exp(-exponent * log(x));
+    }
+
+    double hIntegral(double x) const {
+        double logX = log(x);
+        return expm1OverX((1 - exponent) * logX) * logX;
+    }
+
+    double hIntegralInverse(double x) const {
+        double t = max(-1.0, x * (1 - exponent));
+        return exp(log1pOverX(t) * x);
+    }
+
+public:
+    ZipfDistribution(size_t count, double skew) : exponent(skew), n(static_cast<double>(max<size_t>(1, count))) {
+        hIntegralX1 = hIntegral(1.5) - 1;
+        hIntegralN = hIntegral(n + 0.5);
+        threshold = 2 - hIntegralInverse(hIntegral(2.5) - h(2));
+    }
+
+    template <typename Generator>
+    size_t operator()(Generator& rng) {
+        uniform_real_distribution<double> uniform(0, 1);
+        while (true) {
+            double u = hIntegralN + uniform(rng) * (hIntegralX1 - hIntegralN);
+            double x = hIntegralInverse(u);
+            double k = min(n, max(1.0, floor(x + 0.5)));
+            if (k - x <= threshold || u >= hIntegral(k + 0.5) - h(k)) {
+                return static_cast<size_t>(k);
+            }
+        }
+    }
+};
+
+// Maps popularity ranks onto record numbers so the popular records are spread over the ID range
+class RankScatter {
+private:
+    uint64_t count;
+    uint64_t step;
+
+public:
+    explicit RankScatter(size_t n) : count(max<size_t>(1, n)), step(2654435761u % count) {
+        auto gcd = [](uint64_t a, uint64_t b) {
+            while (b) {
+                a %= b;
+                swap(a, b);
+            }
+            return a;
+        };
+        while (step == 0 || gcd(step, count) != 1) {
+            step = (step + 1) % count;
+        }
+    }
+
+    // Record number (0-based) of a 1-based rank
+    size_t operator()(size_t rank) const {
+        return static_cast<size_t>((rank - 1) * step % count);  // exact while count < 2^32
+    }
+};
+
+// Sizes and shape of a generated data set
+struct DatasetSpec {
+    size_t books = 100000;
+    size_t members = 20000;
+    size_t transactions = 1000000;
+    size_t historyDays = 730;   // borrow dates are spread over this many days up to now
+    double bookSkew = 1.0;      // Zipf exponent of book popularity
+    double memberSkew = 0.8;    // Zipf exponent of member activity
+    uint64_t seed = 20240101;
+};
+
+// Word number i of the synthetic title vocabulary; the same words drive the search workload
+string datasetWord(size_t i) {
+    static const char* const syllables[] = {"ka", "lo", "mi", "ra", "tu", "ven", "sha", "dor", "el", "qui",
+                                            "bar", "ni", "os", "ter", "ju", "wa", "zen", "fa", "gro", "ly"};
+    string word = syllables[i % 20];
+    word += syllables[(i / 20) % 20];
+    if (i >= 400) {
+        word += syllables[(i / 400) % 20];
+    }
+    word[0] = static_cast<char>(toupper(static_cast<unsigned char>(word[0])));
+    return word;
+}
+
+const size_t DATASET_VOCABULARY = 4000;
+
+// Write books.txt, members.txt and transactions.txt for a realistic library: book popularity and
+// member activity follow Zipf distributions, loans are returned early, on time, late or never, and
+// loans still running at the end of the history stay open (at most one per book). Everything is
+// streamed, so only one bit per book is held in memory.
+void generateDataset(const string& dir, const DatasetSpec& spec) {
+    for (const char* name : {"books.txt", "members.txt", "transactions.txt", "library.bin", "journal.log"}) {
+        if (filesystem::exists(dataPath(dir, name))) {
+            throw runtime_error("Directory " + dir + " already holds library data; choose an empty one.");
+        }
+    }
+    if (spec.books == 0 || spec.members == 0) {
+        throw runtime_error("A data set needs at least one book and one member.");
+    }
+    filesystem::create_directories(dir);
+    mt19937_64 rng(spec.seed);
+    const time_t now = time(nullptr);
+    const time_t day = 24 * 60 * 60;
+    const time_t loanPeriod = 14 * day;
+
+    vector<bool> onLoan(spec.books, false);
+    {
+        ofstream file(dataPath(dir, "transactions.txt"), ios::binary);
+        ZipfDistribution pickBook(spec.books, spec.bookSkew);
+        ZipfDistribution pickMember(spec.members, spec.memberSkew);
+        RankScatter bookOf(spec.books);
+        RankScatter memberOf(spec.members);
+        uniform_real_distribution<double> uniform(0, 1);
+        exponential_distribution<double> lateDays(1.0 / 21);
+        geometric_distribution<int> slightlyLateDays(0.25);
+        uniform_int_distribution<time_t> earlyDays(1, 14);
+        uniform_int_distribution<time_t> timeOfDay(9 * 3600, 19 * 3600);
+        time_t first = now - static_cast<time_t>(spec.historyDays) * day;
+        double spacing = static_cast<double>(now - first) / spec.transactions;
+        for (size_t i = 0; i < spec.transactions; i++) {
+            time_t borrowed = first + static_cast<time_t>(i * spacing);
+            borrowed = borrowed - borrowed % day + timeOfDay(rng);
+            if (borrowed >= now) {
+                borrowed = now - 1;
+            }
+            // 60% back early, 25% a few days late, 14.5% well overdue, 0.5% never returned
+            double outcome = uniform(rng);
+            time_t returned;
+            if (outcome < 0.60) {
+                returned = borrowed + earlyDays(rng) * day - 3600;
+            } else if (outcome < 0.85) {
+                returned = borrowed + loanPeriod + (1 + slightlyLateDays(rng)) * day;
+            } else if (outcome < 0.995) {
+                returned = borrowed + loanPeriod + static_cast<time_t>((1 + lateDays(rng)) * day);
+            } else {
+                returned = 0;
+            }
+            bool open = returned == 0 || returned > now;
+
+            size_t book = bookOf(pickBook(rng));
+            for (int attempt = 0; open && onLoan[book] && attempt < 8; attempt++) {
+                book = bookOf(pickBook(rng));
+            }
+            if (open && onLoan[book]) {
+                open = false;  // every copy we tried is out; record this loan as a quick return instead
+                returned = min(now, borrowed + day);
+            }
+            if (open) {
+                onLoan[book] = true;
+                returned = 0;
+            }
+            file << Transaction(to_string(i + 1), "M" + to_string(memberOf(pickMember(rng))),
+                                "B" + to_string(book), borrowed, returned, borrowed + loanPeriod)
+                        .toString()
+                 << '\n';
+        }
+    }
+    {
+        static const char* const genres[] = {"Fiction", "Mystery", "Romance", "Science Fiction", "Fantasy",
+                                             "Biography", "History", "Science", "Poetry", "Children",
+                                             "Thriller", "Horror", "Travel", "Cooking", "Business",
+                                             "Self-Help", "Religion", "Art", "Drama", "Reference"};
+        ZipfDistribution pickWord(DATASET_VOCABULARY, 0.9);
+        ZipfDistribution pickAuthor(spec.books / 8 + 1, 0.7);
+        uniform_int_distribution<int> titleLength(1, 4);
+        ofstream file(dataPath(dir, "books.txt"), ios::binary);
+        for (size_t i = 0; i < spec.books; i++) {
+            string title;
+            for (int w = titleLength(rng); w > 0; w--) {
+                title += (title.empty() ? "" : " ") + datasetWord(pickWord(rng) - 1);
+            }
+            size_t author = pickAuthor(rng);
+            Book book("B" + to_string(i), title, datasetWord(author % 400) + " " + datasetWord(400 + author / 400),
+                      genres[pickWord(rng) % 20]);
+            book.setAvailability(!onLoan[i]);
+            file << book.toString() << '\n';
+        }
+    }
+    {
+        ofstream file(dataPath(dir, "members.txt"), ios::binary);
+        for (size_t i = 0; i < spec.members; i++) {
+            string id = "M" + to_string(i);
+            file << Member(id, datasetWord(i % 400) + " " + datasetWord(400 + (i / 400) % 3600),
+                           to_string(i % 997 + 1) + " " + datasetWord(i % 53) + " Road",
+                           "07" + to_string(10000000 + i % 90000000))
+                        .toString()
+                 << '\n';
+        }
+    }
+}
+
+// Peak resident set size of this process in bytes (0 where unavailable)
+size_t peakResidentBytes() {
+#ifdef __linux__
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return stoull(line.substr(6)) * 1024;
+        }
+    }
+#endif
+    return 0;
+}
+
+// Drive a library loaded from dir through a mixed workload and report throughput, per-operation
+// latency percentiles and peak RSS. The library is opened read-only, so borrows and returns stay
+// in memory and the same data set can be reused between runs.
+//   frontdesk: search-heavy desk traffic with the odd checkout
+//   checkout:  a rush of borrows and returns
+//   reporting: end-of-day reports over the whole history
+void runWorkload(const string& dir, const string& mix, size_t operations) {
+    LibraryOptions options;
+    options.dataDir = dir;
+    options.persistence = PersistenceMode::ReadOnly;
+    unique_ptr<Library> library;
+    double loadSeconds = timeNanoseconds([&] { library.reset(new Library(options)); }) / 1e9;
+    size_t bookCount = library->visitBooks([](const Book&) {}).visited;
+    size_t memberCount = library->visitMembers([](const Member&) {}).visited;
+    if (bookCount == 0 || memberCount == 0) {
+        throw runtime_error("No data set in " + dir + "; create one with --generate.");
+    }
+    cout << "Loaded " << bookCount << " books and " << memberCount << " members in " << fixed << setprecision(2)
+         << loadSeconds << " s\n";
+
+    deque<string> onLoan;  // books to return, oldest loan first
+    library->visitBorrowedBooks([&onLoan](const Book& book, const TransactionRef&) { onLoan.push_back(book.getBookID()); });
+    mt19937_64 rng(7);
+    ZipfDistribution pickBook(bookCount, 1.0);
+    ZipfDistribution pickMember(memberCount, 0.8);
+    ZipfDistribution pickWord(DATASET_VOCABULARY, 0.9);
+    RankScatter bookOf(bookCount);
+    RankScatter memberOf(memberCount);
+    auto randomBook = [&] { return "B" + to_string(bookOf(pickBook(rng))); };
+    auto randomMember = [&] { return "M" + to_string(memberOf(pickMember(rng))); };
+
+    struct Operation {
+        const char* name;
+        unsigned weight;
+        function<void()> run;
+        vector<double> latencies;
+        size_t failures = 0;
+    };
+    map<string, function<void()>> actions = {
+        {"search_books", [&] { library->searchCatalog(datasetWord(pickWord(rng) - 1), 0, 20); }},
+        {"find_book", [&] { library->findBook(randomBook()); }},
+        {"find_member", [&] { library->findMember(randomMember()); }},
+        {"active_loans", [&] { library->getActiveLoans(randomMember()); }},
+        {"borrow_book", [&] {
+             // Patrons take what is on the shelf: skip a few popular titles that are already out
+             string bookID = randomBook();
+             for (int attempt = 0; attempt < 5; attempt++) {
+                 Book* book = library->findBook(bookID);
+                 if (book && book->getAvailability()) {
+                     break;
+                 }
+                 bookID = randomBook();
+             }
+             library->borrowBook(randomMember(), bookID);
+             onLoan.push_back(bookID);
+         }},
+        {"return_book", [&] {
+             if (onLoan.empty()) {
+                 throw runtime_error("Nothing is on loan.");
+             }
+             string bookID = onLoan.front();
+             onLoan.pop_front();
+             library->returnBook(bookID);
+         }},
+        {"borrowed_books", [&] { library->visitBorrowedBooks([](const Book&, const TransactionRef&) {}); }},
+        {"overdue_members", [&] { library->getOverdueMembers(); }},
+        {"circulation_report", [&] { library->getCirculationReport(); }},
+        {"member_history", [&] { library->getMemberHistory(randomMember()); }},
+    };
+    map<string, vector<pair<const char*, unsigned>>> mixes = {
+        {"frontdesk", {{"search_books", 50}, {"find_book", 15}, {"find_member", 10}, {"active_loans", 10},
+                       {"borrow_book", 8}, {"return_book", 7}}},
+        {"checkout", {{"borrow_book", 45}, {"return_book", 45}, {"find_member", 5}, {"active_loans", 5}}},
+        {"reporting", {{"borrowed_books", 30}, {"overdue_members", 30}, {"circulation_report", 20},
+                       {"member_history", 20}}},
+    };
+    vector<string> selected = mix == "all" ? vector<string>{"frontdesk", "checkout", "reporting"} : vector<string>{mix};
+    for (const auto& name : selected) {
+        if (!mixes.count(name)) {
+            throw runtime_error("Unknown workload " + name + "; use frontdesk, checkout, reporting or all.");
+        }
+        vector<Operation> ops;
+        vector<unsigned> weights;
+        for (const auto& entry : mixes[name]) {
+            ops.push_back(Operation{entry.first, entry.second, actions.at(entry.first), {}, 0});
+            weights.push_back(entry.second);
+        }
+        discrete_distribution<size_t> pickOperation(weights.begin(), weights.end());
+        size_t count = operations ? operations : (name == "reporting" ? 100 : 20000);
+        double seconds = timeNanoseconds([&] {
+            for (size_t i = 0; i < count; i++) {
+                Operation& op = ops[pickOperation(rng)];
+                auto start = chrono::steady_clock::now();
+                try {
+                    op.run();
+                } catch (const exception&) {
+                    op.failures++;  // e.g. the book is already out; still a real desk interaction
+                }
+                op.latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+            }
+        }) / 1e9;
+
+        cout << '\n' << name << ": " << count << " operations in " << setprecision(2) << seconds << " s ("
+             << setprecision(0) << count / seconds << " ops/sec), peak RSS " << setprecision(1)
+             << peakResidentBytes() / 1048576.0 << " MB\n";
+        cout << left << setw(20) << "operation" << right << setw(10) << "count" << setw(10) << "failed" << setw(12)
+             << "p50 us" << setw(12) << "p90 us" << setw(12) << "p99 us" << setw(12) << "max us" << '\n';
+        for (auto& op : ops) {
+            if (op.latencies.empty()) {
+                continue;
+            }
+            sort(op.latencies.begin(), op.latencies.end());
+            auto percentile = [&op](double p) {
+                return op.latencies[min(op.latencies.size() - 1, static_cast<size_t>(p * op.latencies.size()))];
+            };
+            cout << left << setw(20) << op.name << right << setw(10) << op.latencies.size() << setw(10) << op.failures
+                 << setprecision(1) << setw(12) << percentile(0.50) << setw(12) << percentile(0.90) << setw(12)
+                 << percentile(0.99) << setw(12) << op.latencies.back() << '\n';
+        }
+    }
+}
+
+// Measure text loading throughput in MB/s
+void runLoadBenchmark(size_t bookCount) {
+    size_t memberCount = max<size_t>(1, bookCount / 10);
+    size_t transactionCount = bookCount * 5;
+    string dir = makeScratchDirectory("lms-bench-load");
+    writeSyntheticTextFiles(dir, bookCount, memberCount, transactionCount);
+    size_t bytes = 0;
+    for (const auto& entry : filesystem::directory_iterator(dir)) {
+        bytes += entry.file_size();
+    }
+
+    LibraryOptions options;
+    options.persistence = PersistenceMode::ReadOnly;
+    options.dataDir = dir;
+    unique_ptr<Library> library;
+    double seconds = timeNanoseconds([&] { library.reset(new Library(options)); }) / 1e9;
+    filesystem::remove_all(dir);
+    if (library->getAllBooks().size() != bookCount || library->getAllTransactions().size() != transactionCount) {
+        throw runtime_error("Load benchmark read the wrong number of records.");
+    }
+    cout << "books " << bookCount << ", members " << memberCount << ", transactions " << transactionCount << '\n'
+         << fixed << setprecision(1) << bytes / 1e6 << " MB in " << seconds * 1000 << " ms: "
+         << bytes / 1e6 / seconds << " MB/s\n";
+}
+
+// Break startup into load and index phases and show how they scale with the thread count
+void runParallelStartupBenchmark(size_t bookCount) {
+    size_t memberCount = max<size_t>(1, bookCount / 10);
+    size_t transactionCount = bookCount * 5;
+    string dir = makeScratchDirectory("lms-bench-parallel");
+    writeSyntheticTextFiles(dir, bookCount, memberCount, transactionCount);
+    size_t cores = max(1u, thread::hardware_concurrency());
+    vector<size_t> threadCounts;
+    for (size_t threads = 1; threads < cores; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(cores);
+
+    cout << "books " << bookCount << ", members " << memberCount << ", transactions " << transactionCount << '\n'
+         << setw(8) << "threads" << setw(12) << "load ms" << setw(12) << "index ms" << setw(12) << "total ms"
+         << setw(10) << "speedup" << '\n';
+    double baseline = 0;
+    for (size_t threads : threadCounts) {
+        LibraryOptions options;
+        options.persistence = PersistenceMode::ReadOnly;
+        options.dataDir = dir;
+        options.loadThreads = threads;
+        Library library(options);
+        library.checkInvariants();
+        if (library.getAllBooks().size() != bookCount || library.getAllTransactions().size() != transactionCount) {
+            throw runtime_error("Parallel load read the wrong number of records.");
+        }
+        StartupTimings timings = library.getStartupTimings();
+        double total = timings.loadMs + timings.indexMs;
+        baseline = baseline ? baseline : total;
+        cout << setw(8) << threads << fixed << setprecision(1) << setw(12) << timings.loadMs << setw(12)
+             << timings.indexMs << setw(12) << total << setw(9) << baseline / total << "x\n";
+    }
+    filesystem::remove_all(dir);
+}
+
+// Import books or members from a CSV file and report throughput
+void runImport(const LibraryOptions& options, const string& kind, const string& path) {
+    ifstream in(path, ios::binary);
+    if (!in) {
+        throw runtime_error("Unable to open " + path + ".");
+    }
+    Library library(options);
+    ImportReport report = kind == "members" ? library.importMembers(in) : library.importBooks(in);
+    cout << "Imported " << report.imported << " " << kind << " from " << report.rowsRead << " rows ("
+         << report.duplicates << " duplicates, " << report.rejected << " rejected) in " << fixed << setprecision(3)
+         << report.seconds << " s: " << setprecision(0) << report.rowsRead / max(report.seconds, 1e-9)
+         << " rows/sec\n";
+    for (const auto& problem : report.problems) {
+        cout << "  " << problem << '\n';
+    }
+}
+
+// Export books or members as CSV to a file, or to standard output for "-"
+void runExport(const LibraryOptions& source, const string& kind, const string& path) {
+    LibraryOptions options = source;
+    options.persistence = PersistenceMode::ReadOnly;
+    Library library(options);
+    ofstream file;
+    if (path != "-") {
+        file.open(path, ios::binary | ios::trunc);
+        if (!file) {
+            throw runtime_error("Unable to write " + path + ".");
+        }
+    }
+    ostream& out = path == "-" ? cout : file;
+    if (kind == "members") {
+        library.exportMembers(out);
+    } else if (kind == "books") {
+        library.exportBooks(out);
+    } else {
+        throw runtime_error("Export kind must be books or members.");
+    }
+    out.flush();
+}
+
+// Open the branches under options.dataDir as one sharded library and print a report gathered from all
+// of them; each line is prefixed with the branch that holds the book or member
+void runBranchReport(const LibraryOptions& source, const string& branchList, const string& report) {
+    vector<string> branches;
+    stringstream names(branchList);
+    string name;
+    while (getline(names, name, ',')) {
+        branches.push_back(name);
+    }
+    LibraryOptions options = source;
+    options.persistence = PersistenceMode::ReadOnly;
+    ShardedLibrary library(options, branches);
+    if (report == "available") {
+        for (const auto& book : library.getAvailableBooks()) {
+            cout << "[" << library.getBookBranch(book.getBookID()) << "] " << book.toString() << '\n';
+        }
+    } else if (report == "borrowed") {
+        for (const auto& loan : library.getBorrowedBooksWithTransactions()) {
+            cout << "[" << library.getBookBranch(loan.first.getBookID()) << "] " << loan.first.toString()
+                 << " | Member ID: " << loan.second.getMemberID()
+                 << " | Due: " << loan.second.getFormattedExpectedReturnDate() << '\n';
+        }
+    } else if (report == "overdue") {
+        for (const auto& entry : library.getOverdueMembers()) {
+            cout << "[" << library.getMemberBranch(entry.first.getMemberID()) << "] " << entry.first.toString()
+                 << " | Overdue Fee: $" << fixed << setprecision(2) << entry.second << '\n';
+        }
+    } else {
+        throw runtime_error("Branch report must be available, borrowed or overdue.");
+    }
+}
+
+// Convert the text data files in dataDir into a binary catalog alongside them
+void convertToBinary(const LibraryOptions& source) {
+    LibraryOptions options = source;
+    options.format = DataFormat::Text;
+    options.persistence = PersistenceMode::ReadOnly;
+    Library library(options);
+    library.writeSnapshot(options.dataDir, DataFormat::Binary);
+    cout << "Wrote " << dataPath(options.dataDir, "library.bin") << '\n';
+}
+
+// Show a visitor walk one page at a time until the records run out or the user stops
+template <typename Walk>
+void showPages(Walk walk) {
+    const size_t pageSize = 20;
+    PageCursor cursor;
+    do {
+        cursor = walk(cursor.next, pageSize);
+        if (!cursor.more) {
+            break;
+        }
+        string more;
+        cout << "Show more? (y/n): ";
+        getline(cin, more);
+        if (more != "y" && more != "Y") {
+            break;
+        }
+    } while (true);
+}
+
+// Print the metrics report to standard error whenever the process receives SIGUSR1. The signal is
+// blocked here, before any other thread starts, and taken by a dedicated thread with sigwait,
+// because a signal handler cannot safely format the report.
+void watchMetricsSignal() {
+    #if defined(__linux__) && !defined(LMS_DISABLE_METRICS)
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        thread([signals] {
+            int received;
+            while (sigwait(&signals, &received) == 0) {
+                cerr << metricsReport(false) << flush;
+            }
+        }).detach();
+    #endif
+}
+
+// Prints the metrics report when main returns, if --metrics asked for it
+struct MetricsOnExit {
+    string format;  // "text", "json", or empty for no report
+
+    ~MetricsOnExit() {
+        if (!format.empty()) {
+            cerr << metricsReport(format == "json");
+        }
+    }
+};
+
+// Function to display the main menu
+void displayMenu() {
+    cout << "\nLibrary Management System\n";
+    cout << "1. Add Book\n";
+    cout << "2. Edit Book\n";
+    cout << "3. Delete Book\n";
+    cout << "4. View All Books\n";
+    cout << "5. Add Member\n";
+    cout << "6. Edit Member\n";
+    cout << "7. Delete Member\n";
+    cout << "8. View All Members\n";
+    cout << "9. Borrow Book\n";
+    cout << "10. Return Book\n";
+    cout << "11. Search Books\n";
+    cout << "12. Search Members\n";
+    cout << "13. View Available Books\n";
+    cout << "14. View Borrowed Books\n";
+    cout << "15. View Overdue Members\n";
+    cout << "16. Clear Screen\n";
+    cout << "17. Circulation Report\n";
+    cout << "18. Performance Metrics\n";
+    cout << "19. Loans Borrowed Between Dates\n";
+    cout << "20. Loans Due Between Dates\n";
+    cout << "21. Loans and Fees As Of Date\n";
+    cout << "0. Exit\n";
+    cout << "Enter your choice: ";
+}
+
+
+int main(int argc, char* argv[]) {
+    vector<string> args(argv + 1, argv + argc);
+    LibraryOptions options;
+    // --serve a read replica of the primary using the same data directory
+    bool replica = find(args.begin(), args.end(), "--replica") != args.end();
+    watchMetricsSignal();
+    MetricsOnExit metricsOnExit;
+    try {
+        // Numeric arguments following a benchmark flag
+        auto sizesFrom = [&args](size_t first, vector<size_t> defaults) {
+            vector<size_t> sizes;
+            for (size_t i = first; i < args.size(); i++) {
+                sizes.push_back(stoul(args[i]));
+            }
+            return sizes.empty() ? defaults : sizes;
+        };
+        for (size_t i = 0; i < args.size(); i++) {
+            if (args[i] == "--binary") {
+                options.format = DataFormat::Binary;
+            } else if (args[i] == "--in-memory") {
+                options.persistence = PersistenceMode::None;
+            } else if (args[i] == "--exec" && i + 1 < args.size()) {
+                // --exec <script|-> [csv|json]: run commands without the menu and exit
+                string format = i + 2 < args.size() ? args[i + 2] : "csv";
+                if (format != "csv" && format != "json") {
+                    cerr << "Usage: --exec <script|-> [csv|json]" << endl;
+                    return 1;
+                }
+                FILE* script = args[i + 1] == "-" ? stdin : fopen(args[i + 1].c_str(), "rb");
+                if (!script) {
+                    throw runtime_error("Unable to open " + args[i + 1] + ".");
+                }
+                ScriptReport report;
+                {
+                    Library library(options);
+                    report = runScript(library, script, stdout, format == "json");
+                }
+                if (script != stdin) {
+                    fclose(script);
+                }
+                cerr << "Executed " << report.commands << " commands in " << fixed << setprecision(3)
+                     << report.seconds << " s (" << setprecision(0) << report.commands / max(report.seconds, 1e-9)
+                     << " commands/sec), " << report.failed << " failed" << endl;
+                return report.failed ? 1 : 0;
+            } else if (args[i] == "--replica") {
+                continue;  // read before the loop, so it may follow --serve
+            } else if (args[i] == "--data-dir" && i + 1 < args.size()) {
+                options.dataDir = args[++i];
+            } else if (args[i] == "--metrics" && i + 1 < args.size()) {
+                metricsOnExit.format = args[++i];
+                if (metricsOnExit.format != "text" && metricsOnExit.format != "json") {
+                    cerr << "Usage: --metrics text|json" << endl;
+                    return 1;
+                }
+            } else if (args[i] == "--serve" || args[i] == "--loadgen") {
+                #ifdef __linux__
+                    if (i + 1 >= args.size()) {
+                        cerr << "Usage: " << args[i] << " unix:PATH|tcp:PORT" << endl;
+                        return 1;
+                    }
+                    if (args[i] == "--serve") {
+                        runServer(options, args[i + 1], replica);
+                    } else {
+                        vector<size_t> settings = sizesFrom(i + 2, {4, 5});  // connections, seconds
+                        runLoadGenerator(args[i + 1], settings[0], settings.size() > 1 ? settings[1] : 5);
+                    }
+                    return 0;
+                #else
+                    cerr << args[i] << " is only supported on Linux." << endl;
+                    return 1;
+                #endif
+            } else if ((args[i] == "--import" || args[i] == "--import-books" || args[i] == "--import-members") &&
+                       i + 1 < args.size()) {
+                string path = args[i + 1];
+                string kind = args[i] == "--import-members" ? "members" : "books";
+                if (args[i] == "--import" && filesystem::path(path).filename().string().compare(0, 6, "member") == 0) {
+                    kind = "members";
+                }
+                runImport(options, kind, path);
+                return 0;
+            } else if (args[i] == "--export" && i + 2 < args.size()) {
+                runExport(options, args[i + 1], args[i + 2]);
+                return 0;
+            } else if (args[i] == "--branches" && i + 2 < args.size()) {
+                runBranchReport(options, args[i + 1], args[i + 2]);
+                return 0;
+            } else if (args[i] == "--convert-to-binary") {
+                convertToBinary(options);
+                return 0;
+            } else if (args[i] == "--generate" && i + 1 < args.size()) {
+                DatasetSpec spec;
+                vector<size_t> sizes = sizesFrom(i + 2, {spec.books, spec.members, spec.transactions});
+                spec.books = sizes[0];
+                spec.members = sizes.size() > 1 ? sizes[1] : max<size_t>(1, spec.books / 5);
+                spec.transactions = sizes.size() > 2 ? sizes[2] : spec.books * 10;
+                double seconds = timeNanoseconds([&] { generateDataset(args[i + 1], spec); }) / 1e9;
+                cout << "Wrote " << spec.books << " books, " << spec.members << " members and " << spec.transactions
+                     << " transactions to " << args[i + 1] << " in " << fixed << setprecision(1) << seconds << " s\n";
+                return 0;
+            } else if (args[i] == "--workload" && i + 1 < args.size()) {
+                string mix = i + 2 < args.size() ? args[i + 2] : "all";
+                runWorkload(args[i + 1], mix, i + 3 < args.size() ? stoul(args[i + 3]) : 0);
+                return 0;
+            } else if (args[i] == "--bench-lookup") {
+                runLookupBenchmark(sizesFrom(i + 1, {10000, 1000000, 10000000}));
+                return 0;
+            } else if (args[i] == "--bench-search") {
+                for (size_t n : sizesFrom(i + 1, {100000, 1000000})) {
+                    runSearchBenchmark(n);
+                }
+                return 0;
+            } else if (args[i] == "--bench-scan") {
+                for (size_t n : sizesFrom(i + 1, {10000000})) {
+                    runScanBenchmark(n);
+                }
+                return 0;
+            } else if (args[i] == "--stress-concurrency") {
+                size_t cores = max(1u, thread::hardware_concurrency());
+                runConcurrencyStressTest(sizesFrom(i + 1, {1, 2, 4, cores}));
+                return 0;
+            } else if (args[i] == "--bench-load") {
+                for (size_t n : sizesFrom(i + 1, {1000000})) {
+                    runLoadBenchmark(n);
+                }
+                return 0;
+            } else if (args[i] == "--bench-snapshot") {
+                for (size_t n : sizesFrom(i + 1, {1000000})) {
+                    cout << n << " books\n";
+                    runSnapshotBenchmark(n);
+                }
+                return 0;
+            } else if (args[i] == "--bench-batch") {
+                runBatchBenchmark(sizesFrom(i + 1, {1, 10, 100, 1000}));
+                return 0;
+            } else if (args[i] == "--bench-memory") {
+                for (size_t n : sizesFrom(i + 1, {5000000})) {
+                    runTransactionStoreBenchmark(n);
+                }
+                return 0;
+            } else if (args[i] == "--bench-analytics") {
+                for (size_t n : sizesFrom(i + 1, {1000000})) {
+                    runAnalyticsBenchmark(n);
+                }
+                return 0;
+            } else if (args[i] == "--bench-parallel-load") {
+                for (size_t n : sizesFrom(i + 1, {1000000})) {
+                    runParallelStartupBenchmark(n);
+                }
+                return 0;
+            } else if (args[i] == "--bench-date-range") {
+                for (size_t n : sizesFrom(i + 1, {1000000})) {
+                    runDateRangeBenchmark(n);
+                }
+                return 0;
+            } else if (args[i] == "--bench-sharded") {
+                for (size_t n : sizesFrom(i + 1, {1000000})) {
+                    runShardedBenchmark(n);
+                }
+                return 0;
+            } else if (args[i] == "--bench-startup") {
+                for (size_t n : sizesFrom(i + 1, {1000000})) {
+                    runStartupBenchmark(n);
+                }
+                return 0;
+            } else {
+                cerr << "Unknown option: " << args[i] << endl;
+                return 1;
+            }
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    if (replica) {
+        cerr << "Usage: --replica --serve unix:PATH|tcp:PORT" << endl;
+        return 1;
+    }
+
+    Library library(options);
+    int choice;
+
+    do {
+        displayMenu();
+        cin >> choice;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+        try {
+            switch (choice) {
+                case 1: {
+                    string id, title, author, genre;
+                    cout << "Enter Book ID: ";
+                    getline(cin, id);
+                    cout << "Enter Title: ";
+                    getline(cin, title);
+                    cout << "Enter Author: ";
+                    getline(cin, author);
+                    cout << "Enter Genre: ";
+                    getline(cin, genre);
+                    library.addBook(Book(id, title, author, genre));
+                    cout << "Book added successfully.\n";
+                    break;
+                }
+                case 2: {
+                    string id, title, author, genre;
+                    cout << "Enter Book ID to edit: ";
+                    getline(cin, id);
+                    cout << "Enter new Title: ";
+                    getline(cin, title);
+                    cout << "Enter new Author: ";
+                    getline(cin, author);
+                    cout << "Enter new Genre: ";
+                    getline(cin, genre);
+                    library.editBook(id, Book(id, title, author, genre));
+                    cout << "Book edited successfully.\n";
+                    break;
+                }
+                case 3: {
+                    string id;
+                    cout << "Enter Book ID to delete: ";
+                    getline(cin, id);
+                    library.deleteBook(id);
+                    cout << "Book deleted successfully.\n";
+                    break;
+                }
+                case 4: {
+                    showPages([&](size_t offset, size_t limit) {
+                        return library.visitBooks([](const Book& book) { cout << book.toString() << endl; }, offset,
+                                                  limit);
+                    });
+                    break;
+                }
+                case 5: {
+                    string id, name, address, phone;
+                    cout << "Enter Member ID: ";
+                    getline(cin, id);
+                    cout << "Enter Name: ";
+                    getline(cin, name);
+                    cout << "Enter Address: ";
+                    getline(cin, address);
+                    cout << "Enter Phone Number: ";
+                    getline(cin, phone);
+                    library.addMember(Member(id, name, address, phone));
+                    cout << "Member added successfully.\n";
+                    break;
+                }
+                case 6: {
+                    string id, name, address, phone;
+                    cout << "Enter Member ID to edit: ";
+                    getline(cin, id);
+                    cout << "Enter new Name: ";
+                    getline(cin, name);
+                    cout << "Enter new Address: ";
+                    getline(cin, address);
+                    cout << "Enter new Phone Number: ";
+                    getline(cin, phone);
+                    library.editMember(id, Member(id, name, address, phone));
+                    cout << "Member edited successfully.\n";
+                    break;
+                }
+                case 7: {
+                    string id;
+                    cout << "Enter Member ID to delete: ";
+                    getline(cin, id);
+                    library.deleteMember(id);
+                    cout << "Member deleted successfully.\n";
+                    break;
+                }
+                case 8: {
+                    showPages([&](size_t offset, size_t limit) {
+                        return library.visitMembers([](const Member& member) { cout << member.toString() << endl; },
+                                                    offset, limit);
+                    });
+                    break;
+                }
+                case 9: {
+                    string memberID, bookID;
+                    cout << "Enter Member ID: ";
+                    getline(cin, memberID);
+                    cout << "Enter Book ID (separate several IDs with commas): ";
+                    getline(cin, bookID);
+                    CsvParser ids;
+                    ids.parse(bookID.data(), bookID.data() + bookID.size());
+                    vector<string> bookIDs;
+                    size_t blank = 0;
+                    for (size_t i = 0; i < ids.size(); i++) {
+                        string id = ids.str(i);
+                        size_t first = id.find_first_not_of(" \t");
+                        if (first == string::npos) {
+                            blank++;
+                            continue;
+                        }
+                        bookIDs.push_back(id.substr(first, id.find_last_not_of(" \t") - first + 1));
+                    }
+                    if (bookIDs.empty()) {
+                        throw runtime_error("No book IDs entered.");
+                    }
+                    if (blank > 0) {
+                        throw runtime_error("The list of book IDs has an empty entry.");
+                    }
+                    if (bookIDs.size() == 1) {
+                        string transactionID = library.borrowBook(memberID, bookIDs[0]);
+                        cout << "Book borrowed successfully. Transaction ID: " << transactionID << endl;
+                        break;
+                    }
+                    vector<string> transactionIDs = library.borrowBooks(memberID, bookIDs);
+                    cout << transactionIDs.size() << " books borrowed successfully.";
+                    if (!transactionIDs.empty()) {
+                        cout << " Transaction IDs: " << transactionIDs.front() << "-" << transactionIDs.back();
+                    }
+                    cout << endl;
+                    break;
+                }
+                case 10: {
+                    string bookIdentifier;
+                    cout << "Enter Book ID or Title to return: ";
+                    getline(cin, bookIdentifier);
+                    library.returnBook(bookIdentifier);
+                    cout << "Book returned successfully.\n";
+                    break;
+                }
+                case 11: {
+                    string query;
+                    cout << "Enter search query for books (ID, Title, Author or Genre): ";
+                    getline(cin, query);
+                    const size_t pageSize = 20;
+                    for (size_t offset = 0;; offset += pageSize) {
+                        SearchPage page = library.searchCatalog(query, offset, pageSize);
+                        for (const auto& book : page.books) {
+                            cout << book.toString() << endl;
+                        }
+                        cout << "Showing " << min(offset + page.books.size(), page.totalMatches) << " of "
+                             << page.totalMatches << " matches." << endl;
+                        if (offset + pageSize >= page.totalMatches) {
+                            break;
+                        }
+                        string more;
+                        cout << "Show more? (y/n): ";
+                        getline(cin, more);
+                        if (more != "y" && more != "Y") {
+                            break;
+                        }
+                    }
+                    break;
+                }
+                case 12: {
+                    string query;
+                    cout << "Enter search query for members (ID or Name): ";
+                    getline(cin, query);
+                    showPages([&](size_t offset, size_t limit) {
+                        return library.visitMemberMatches(
+                            query, [](const Member& member) { cout << member.toString() << endl; }, offset, limit);
+                    });
+                    break;
+                }
+                case 13: {
+                    showPages([&](size_t offset, size_t limit) {
+                        return library.visitAvailableBooks([](const Book& book) { cout << book.toString() << endl; },
+                                                           offset, limit);
+                    });
+                    break;
+                }
+                case 14: {
+                    bool any = false;
+                    time_t now = library.currentTime();
+                    auto printLoan = [&any, now](const Book& book, const TransactionRef& transaction) {
+                        if (!any) {
+                            cout << "Borrowed Books:" << endl;
+                            any = true;
+                        }
+                        cout << "Book: " << book.getTitle() << " (ID: " << book.getBookID() << ")" << endl;
+                        cout << "  Borrowed by Member ID: " << transaction.getMemberID() << endl;
+                        cout << "  Transaction ID: " << transaction.getTransactionID() << endl;
+                        cout << "  Borrow Date: " << transaction.getFormattedBorrowDate() << endl;
+                        cout << "  Expected Return Date: " << transaction.getFormattedExpectedReturnDate() << endl;
+                        cout << "  Days Overdue: " << transaction.calculateOverdueDays(now) << endl;
+                        cout << "  Overdue Fee: KSH " << fixed << setprecision(2) << transaction.calculateOverdueFees(now)
+                             << endl;
+                        cout << endl;
+                    };
+                    showPages([&](size_t offset, size_t limit) {
+                        return library.visitBorrowedBooks(printLoan, offset, limit);
+                    });
+                    if (!any) {
+                        cout << "No books are currently borrowed." << endl;
+                    }
+                    break;
+                }
+                case 15: {
+                    auto overdueMembers = library.getOverdueMembers();
+                    for (const auto& pair : overdueMembers) {
+                        cout << pair.first.toString() << " | Overdue Fee: $" << fixed << setprecision(2) << pair.second << endl;
+                    }
+                    break;
+                }
+                case 16: {
+                    clearScreen();
+                    break;
+                }
+                case 17: {
+                    CirculationReport report = library.getCirculationReport();
+                    auto printRanking = [](const string& heading, const vector<pair<string, uint64_t>>& entries) {
+                        cout << heading << ":" << endl;
+                        for (const auto& entry : entries) {
+                            cout << "  " << entry.first << ": " << entry.second << endl;
+                        }
+                    };
+                    printRanking("Loans by Genre", report.loansByGenre);
+                    printRanking("Most Borrowed Authors", report.topAuthors);
+                    printRanking("Most Borrowed Titles", report.topTitles);
+                    printRanking("Most Active Members", report.topMembers);
+                    printRanking("Loans by Month", report.loansByMonth);
+                    cout << "Total Loans: " << report.totalLoans << " (" << report.openLoans << " open)" << endl;
+                    cout << "Average Loan Duration: " << fixed << setprecision(1) << report.averageLoanDays << " days"
+                         << endl;
+                    cout << "Overdue Fees Charged: KSH " << setprecision(2) << report.feesCharged << endl;
+                    cout << "Overdue Fees Outstanding: KSH " << report.feesOutstanding << endl;
+                    break;
+                }
+                case 18:
+                    cout << metricsReport(false);
+                    break;
+                case 19:
+                case 20: {
+                    string from, to;
+                    cout << "Enter start date (YYYY-MM-DD): ";
+                    getline(cin, from);
+                    cout << "Enter end date, exclusive (YYYY-MM-DD): ";
+                    getline(cin, to);
+                    time_t start = parseDate(from);
+                    time_t end = parseDate(to);
+                    auto printLoan = [](const TransactionRef& transaction) {
+                        cout << "Transaction " << transaction.getTransactionID() << ": Book "
+                             << transaction.getBookID() << ", Member " << transaction.getMemberID() << ", borrowed "
+                             << transaction.getFormattedBorrowDate() << ", due "
+                             << transaction.getFormattedExpectedReturnDate() << ", "
+                             << (transaction.getReturnDate()
+                                     ? "returned " + Transaction::getFormattedDate(transaction.getReturnDate())
+                                     : string("on loan"))
+                             << endl;
+                    };
+                    showPages([&](size_t offset, size_t limit) {
+                        return choice == 19 ? library.visitLoansBorrowed(start, end, printLoan, offset, limit)
+                                            : library.visitLoansDue(start, end, printLoan, offset, limit);
+                    });
+                    break;
+                }
+                case 21: {
+                    string date;
+                    cout << "Enter date (YYYY-MM-DD, blank for now): ";
+                    getline(cin, date);
+                    auto snapshot = library.openSnapshot(date.empty() ? 0 : parseDate(date));
+                    time_t at = snapshot->getTime();
+                    cout << "Loans out on " << Transaction::getFormattedDate(at) << ":" << endl;
+                    auto printLoan = [at](const Book& book, const Transaction& transaction) {
+                        cout << "Book: " << book.getTitle() << " (ID: " << book.getBookID() << ")" << endl;
+                        cout << "  Borrowed by Member ID: " << transaction.getMemberID() << endl;
+                        cout << "  Transaction ID: " << transaction.getTransactionID() << endl;
+                        cout << "  Borrow Date: " << transaction.getFormattedBorrowDate() << endl;
+                        cout << "  Expected Return Date: " << transaction.getFormattedExpectedReturnDate() << endl;
+                        cout << "  Days Overdue: " << transaction.calculateOverdueDays(at) << endl;
+                        cout << "  Overdue Fee: KSH " << fixed << setprecision(2) << transaction.calculateOverdueFees(at)
+                             << endl;
+                        cout << endl;
+                    };
+                    showPages([&](size_t offset, size_t limit) {
+                        return snapshot->visitOpenLoans(printLoan, offset, limit);
+                    });
+                    for (const auto& owed : snapshot->getFeesOwed()) {
+                        cout << owed.first.toString() << " | Fees Owed: KSH " << fixed << setprecision(2) << owed.second
+                             << endl;
+                    }
+                    break;
+                }
+                case 0:
+                    cout << "Exiting...\n";
+                    break;
+                default:
+                    cout << "Invalid choice. Please try again.\n";
+            }
+         } catch (const exception& e) {
+            cout << "Error: " << e.what() << endl;
+        }
+
+        if (choice != 0 && choice != 16) {
+            cout << "Press Enter to continue...";
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+
+    } while (choice != 0);
+
+    return 0;
+}
+
+
+
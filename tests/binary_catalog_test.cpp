@@ -0,0 +1,72 @@
+// Binary catalog headers: record counts that would overflow the section offsets, or sizes larger
+// than the file, must be rejected before any column is read.
+#define main lms_main
+#include "../main.cpp"
+#undef main
+
+static int failures = 0;
+
+static void check(bool condition, const string& what) {
+    if (!condition) {
+        cerr << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+// Write a copy of the catalog with the header changed by edit, and report whether it is rejected
+template <typename Edit>
+static bool rejected(const string& catalog, const string& path, Edit edit) {
+    string corrupt = catalog;
+    edit(*reinterpret_cast<binary::Header*>(&corrupt[0]));
+    {
+        ofstream file(path, ios::binary);
+        file << corrupt;
+    }
+    try {
+        BinaryCatalogView view(path);
+    } catch (const runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    string dir = (filesystem::temp_directory_path() / "lms_binary_catalog_test").string();
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+    string path = dataPath(dir, "library.bin");
+
+    BinaryCatalogWriter writer;
+    writer.addBook(Book("B1", "Emma", "Austen", "Romance"));
+    writer.addMember(Member("M1", "Ann", "Nairobi", "0700"));
+    writer.addTransaction(Transaction("1", "M1", "B1", 100, 0, 200));
+    writer.write(path);
+    string catalog;
+    {
+        ifstream file(path, ios::binary);
+        catalog.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+    {
+        BinaryCatalogView view(path);
+        check(view.bookID(0) == "B1" && view.memberID(0) == "M1" && view.transactionBookID(0) == "B1",
+              "a valid catalog reads back");
+    }
+
+    const uint64_t huge = numeric_limits<uint64_t>::max();
+    check(rejected(catalog, path, [](binary::Header& h) { h.bookCount = 1000; }), "book count past the end");
+    check(rejected(catalog, path, [&](binary::Header& h) { h.bookCount = huge / 33 + 1; }),
+          "book count whose section size overflows");
+    check(rejected(catalog, path, [](binary::Header& h) { h.memberCount = uint64_t(1) << 60; }),
+          "member count whose section size wraps to zero");
+    check(rejected(catalog, path, [&](binary::Header& h) { h.transactionCount = huge / 48 + 1; }),
+          "transaction count whose section size overflows");
+    check(rejected(catalog, path, [&](binary::Header& h) { h.heapSize = huge; }), "heap size past the end");
+
+    filesystem::remove_all(dir);
+    if (failures > 0) {
+        cerr << failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "binary catalog tests passed" << endl;
+    return 0;
+}
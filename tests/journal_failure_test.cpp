@@ -0,0 +1,174 @@
+// Journal write failures: a mutation whose journal write fails must leave the library unchanged,
+// and the records around it must replay cleanly after a crash. Writes are made to fail with a
+// file size limit (RLIMIT_FSIZE), which the kernel enforces like a full disk.
+#define main lms_main
+#include "../main.cpp"
+#undef main
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static int failures = 0;
+
+static void check(bool condition, const string& what) {
+    if (!condition) {
+        cerr << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+// Limit the size of any file this process writes to bytes past the journal's current end
+static void limitJournal(const string& dir, uintmax_t extra) {
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = filesystem::file_size(dataPath(dir, "journal.log")) + extra;
+    setrlimit(RLIMIT_FSIZE, &limit);
+}
+
+static void liftLimit() {
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_FSIZE, &limit);
+}
+
+template <typename Action>
+static bool throws(Action action) {
+    try {
+        action();
+    } catch (const exception&) {
+        return true;
+    }
+    return false;
+}
+
+// Run body in a child that exits without destructors, as if the process crashed afterwards
+template <typename Body>
+static void crashAfter(Body body) {
+    pid_t child = fork();
+    if (child == 0) {
+        body();
+        _exit(failures == 0 ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child checks");
+}
+
+int main() {
+    signal(SIGXFSZ, SIG_IGN);
+    string dir = (filesystem::temp_directory_path() / "lms_journal_failure_test").string();
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+
+    LibraryOptions options;
+    options.dataDir = dir;
+    options.hotMonths = 0;
+
+    // Per-operation sync: the failed borrow, add and edit leave memory as it was
+    crashAfter([&] {
+        Library library(options);
+        library.addBook(Book("B1", "Emma", "Austen", "Romance"));
+        library.addMember(Member("M1", "Ann", "Nairobi", "0700"));
+
+        limitJournal(dir, 0);
+        check(throws([&] { library.borrowBook("M1", "B1"); }), "borrow with a failing journal throws");
+        check(throws([&] { library.addBook(Book("B2", "Dune", "Herbert", "Science Fiction")); }),
+              "add with a failing journal throws");
+        check(throws([&] { library.editBook("B1", Book("B1", "Persuasion", "Austen", "Romance")); }),
+              "edit with a failing journal throws");
+        liftLimit();
+
+        check(library.findBook("B1")->getAvailability(), "failed borrow leaves the book on the shelf");
+        check(library.getActiveLoans("M1").empty(), "failed borrow leaves no loan");
+        check(library.findBook("B2") == nullptr, "failed add leaves no book");
+        check(library.findBook("B1")->getTitle() == "Emma", "failed edit leaves the old title");
+        library.checkInvariants();
+
+        // A write cut short part-way is removed, so the next record does not follow a torn one
+        limitJournal(dir, 5);
+        check(throws([&] { library.addMember(Member("M2", "Bob", "Mombasa", "0711")); }),
+              "add with a partly failing journal throws");
+        liftLimit();
+        check(library.borrowBook("M1", "B1") == "1", "the failed borrow did not use up a transaction ID");
+    });
+    {
+        Library library(options);
+        library.checkInvariants();
+        check(library.findBook("B2") == nullptr, "replay: failed add is not in the journal");
+        check(library.findMember("M2") == nullptr, "replay: partly written add is not in the journal");
+        check(library.findBook("B1")->getTitle() == "Emma", "replay: failed edit is not in the journal");
+        check(library.getActiveLoans("M1").size() == 1, "replay: the borrow after the failures is kept");
+    }
+
+    // Group commit: records are written as they are appended and only their sync waits for the
+    // group, so a crash before the sync keeps them; a record whose write fails is withdrawn alone
+    options.syncPolicy = SyncPolicy::GroupCommit;
+    options.groupCommitSize = 3;
+    crashAfter([&] {
+        Library library(options);
+        library.addBook(Book("B3", "Ulysses", "Joyce", "Fiction"));
+        library.addBook(Book("B4", "Beloved", "Morrison", "Fiction"));
+        limitJournal(dir, 0);
+        check(throws([&] { library.addBook(Book("B5", "Hamlet", "Shakespeare", "Drama")); }),
+              "add whose journal write fails throws");
+        liftLimit();
+        check(library.findBook("B5") == nullptr, "failed group add leaves no book");
+        check(library.findBook("B3") != nullptr && library.findBook("B4") != nullptr, "earlier group adds stay");
+    });
+    {
+        Library library(options);
+        library.checkInvariants();
+        check(library.findBook("B3") != nullptr && library.findBook("B4") != nullptr,
+              "replay: records awaiting their group sync survive a crash");
+        check(library.findBook("B5") == nullptr, "replay: the withdrawn record is not in the journal");
+    }
+
+    // A complete record that cannot be applied stops the start instead of silently ending the replay
+    // there and dropping the records after it
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+    {
+        ofstream journal(dataPath(dir, "journal.log"), ios::binary);
+        journal << "1,AB,B1,Emma,Austen,Romance,Available\n"
+                << "2,RT,B1,100\n"
+                << "3,AB,B2,Dune,Herbert,Science Fiction,Available\n";
+    }
+    check(throws([&] { Library library(options); }), "a record that fails to apply is reported");
+
+    // Checkpoint crash window: the data files are renamed into place one at a time. A checkpoint cut
+    // short part-way (here transactions.txt cannot be replaced) must not leave new data files under
+    // the old checkpoint, or the journal records they hold would be replayed on top of them again.
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+    options.syncPolicy = SyncPolicy::PerOperation;
+    options.compactionThreshold = 4;  // the fourth record starts a background checkpoint
+    string blocker = dataPath(dir, "transactions.txt");
+    crashAfter([&] {
+        {
+            Library library(options);
+            filesystem::create_directories(dataPath(blocker, "in-the-way"));
+            library.addBook(Book("B1", "Emma", "Austen", "Romance"));
+            library.addBook(Book("B2", "Dune", "Herbert", "Science Fiction"));
+            library.addMember(Member("M1", "Ann", "Nairobi", "0700"));
+            library.borrowBook("M1", "B1");
+        }  // the closing checkpoint fails the same way
+        check(filesystem::exists(dataPath(dir, "members.txt")), "the checkpoint published some data files");
+    });
+    filesystem::remove_all(blocker);
+    {
+        Library library(options);
+        library.checkInvariants();
+        check(library.getAllBooks().size() == 2, "checkpoint window: books are not replayed twice");
+        check(library.getAllMembers().size() == 1, "checkpoint window: members are not replayed twice");
+        check(library.getAllTransactions().size() == 1, "checkpoint window: the loan is not replayed twice");
+    }
+
+    filesystem::remove_all(dir);
+    if (failures > 0) {
+        cerr << failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "journal failure tests passed" << endl;
+    return 0;
+}